@@ -0,0 +1,122 @@
+/**
+* @file aesd-circular-buffer-mpsc.c
+* @brief Multi-producer, single-consumer lock-free aesd circular buffer
+*/
+
+#include <string.h>
+#include "aesd-circular-buffer-mpsc.h"
+
+#define AESD_MPSC_SLOTS AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+
+void aesd_mpsc_circular_buffer_init(struct aesd_mpsc_circular_buffer *buffer)
+{
+    size_t i;
+
+    memset(buffer, 0, sizeof(*buffer));
+    /* Slot i is free for the producer that claims position i */
+    for (i = 0; i < AESD_MPSC_SLOTS; i++)
+        atomic_init(&buffer->slot[i].seq, i);
+    atomic_init(&buffer->in_pos, 0);
+    atomic_init(&buffer->out_pos, 0);
+    atomic_init(&buffer->total_size, 0);
+}
+
+bool aesd_mpsc_circular_buffer_add_entry(
+    struct aesd_mpsc_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry)
+{
+    struct aesd_mpsc_slot *slot;
+    size_t pos;
+
+    if (buffer == NULL || add_entry == NULL)
+        return false;
+
+    pos = atomic_load_explicit(&buffer->in_pos, memory_order_relaxed);
+    for (;;) {
+        size_t seq;
+        intptr_t dif;
+
+        slot = &buffer->slot[pos % AESD_MPSC_SLOTS];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            /* Slot is free for pos, try to claim it; failure reloads pos */
+            if (atomic_compare_exchange_weak_explicit(&buffer->in_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            /* Still holds the entry from one lap ago */
+            return false;
+        } else {
+            /* Another producer claimed pos first */
+            pos = atomic_load_explicit(&buffer->in_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->entry = *add_entry;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    atomic_fetch_add_explicit(&buffer->total_size, add_entry->size, memory_order_relaxed);
+    return true;
+}
+
+struct aesd_buffer_entry *aesd_mpsc_circular_buffer_entry_at(
+    struct aesd_mpsc_circular_buffer *buffer,
+    size_t pos)
+{
+    struct aesd_mpsc_slot *slot = &buffer->slot[pos % AESD_MPSC_SLOTS];
+    size_t out = atomic_load_explicit(&buffer->out_pos, memory_order_relaxed);
+
+    /* Positions a lap ahead of out_pos alias slots still in use */
+    if (pos - out >= AESD_MPSC_SLOTS)
+        return NULL;
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        return NULL;
+    return &slot->entry;
+}
+
+bool aesd_mpsc_circular_buffer_remove_entry(
+    struct aesd_mpsc_circular_buffer *buffer,
+    struct aesd_buffer_entry *removed)
+{
+    struct aesd_mpsc_slot *slot;
+    size_t pos;
+
+    if (buffer == NULL || removed == NULL)
+        return false;
+
+    pos = atomic_load_explicit(&buffer->out_pos, memory_order_relaxed);
+    slot = &buffer->slot[pos % AESD_MPSC_SLOTS];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        return false;
+
+    *removed = slot->entry;
+    atomic_store_explicit(&buffer->out_pos, pos + 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&buffer->total_size, removed->size, memory_order_relaxed);
+    /* Hand the slot to the producer that claims it on the next lap */
+    atomic_store_explicit(&slot->seq, pos + AESD_MPSC_SLOTS, memory_order_release);
+    return true;
+}
+
+struct aesd_buffer_entry *aesd_mpsc_circular_buffer_find_entry_offset_for_fpos(
+    struct aesd_mpsc_circular_buffer *buffer,
+    size_t char_offset,
+    size_t *entry_offset_byte_rtn)
+{
+    struct aesd_buffer_entry *entry;
+    size_t cumulative = 0;
+    size_t index;
+
+    if (buffer == NULL || entry_offset_byte_rtn == NULL)
+        return NULL;
+
+    AESD_MPSC_CIRCULAR_BUFFER_FOREACH(entry, buffer, index) {
+        if (char_offset < cumulative + entry->size) {
+            *entry_offset_byte_rtn = char_offset - cumulative;
+            return entry;
+        }
+        cumulative += entry->size;
+    }
+
+    return NULL;
+}
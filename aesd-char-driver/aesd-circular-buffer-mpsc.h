@@ -0,0 +1,102 @@
+/*
+* aesd-circular-buffer-mpsc.h
+*
+*  @brief Lock-free variant of aesd_circular_buffer for userspace, e.g. an
+*  in-process command log in aesdsocket. Any number of threads may add
+*  entries concurrently; one consumer thread owns eviction and is the only
+*  thread allowed to remove, scan or iterate entries.
+*
+*  Each slot carries a sequence number (a bounded MPMC queue in the style of
+*  Dmitry Vyukov's, reduced to a single consumer). A producer claims a slot
+*  by advancing in_pos with a compare-and-swap, fills it, then publishes it
+*  by storing pos + 1 into the slot sequence. The consumer sees an entry
+*  only once that store is visible and returns the slot by storing
+*  pos + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED.
+*
+*  Unlike aesd_circular_buffer_add_entry(), adding to a full buffer does not
+*  overwrite: a producer cannot free the oldest entry while the consumer may
+*  be reading it, so the add fails and the consumer is expected to evict.
+*/
+
+#ifndef AESD_CIRCULAR_BUFFER_MPSC_H
+#define AESD_CIRCULAR_BUFFER_MPSC_H
+
+#ifdef __KERNEL__
+#error "aesd-circular-buffer-mpsc is userspace only, the driver publishes rings with SRCU"
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "aesd-circular-buffer.h"
+
+#define AESD_CACHELINE_SIZE 64
+
+struct aesd_mpsc_slot
+{
+    atomic_size_t seq;
+    struct aesd_buffer_entry entry;
+};
+
+struct aesd_mpsc_circular_buffer
+{
+    struct aesd_mpsc_slot slot[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /* Producers and the consumer advance their positions on separate lines */
+    _Alignas(AESD_CACHELINE_SIZE) atomic_size_t in_pos;
+    _Alignas(AESD_CACHELINE_SIZE) atomic_size_t out_pos;
+    /*
+     * Sum of the sizes of published entries. Producers add after publishing
+     * and the consumer subtracts after removing, so it can briefly lag the
+     * entries visible to a scan.
+     */
+    atomic_size_t total_size;
+};
+
+extern void aesd_mpsc_circular_buffer_init(struct aesd_mpsc_circular_buffer *buffer);
+
+/**
+ * Adds entry to buffer. Safe to call from any number of threads at once.
+ * Returns false without waiting if the buffer is full; the consumer must
+ * remove an entry before the add can succeed.
+ */
+extern bool aesd_mpsc_circular_buffer_add_entry(
+    struct aesd_mpsc_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry);
+
+/**
+ * Removes the oldest published entry and copies it to removed so the caller
+ * can free its memory. Consumer only. Returns false if nothing is published.
+ */
+extern bool aesd_mpsc_circular_buffer_remove_entry(
+    struct aesd_mpsc_circular_buffer *buffer,
+    struct aesd_buffer_entry *removed);
+
+/**
+ * Same contract as aesd_circular_buffer_find_entry_offset_for_fpos(), over
+ * the entries published when the scan reaches them. Consumer only, but may
+ * run while producers add.
+ */
+extern struct aesd_buffer_entry *aesd_mpsc_circular_buffer_find_entry_offset_for_fpos(
+    struct aesd_mpsc_circular_buffer *buffer,
+    size_t char_offset,
+    size_t *entry_offset_byte_rtn);
+
+/**
+ * Returns the entry at absolute position pos if it is published and not yet
+ * removed, NULL otherwise. Consumer only, used by the FOREACH macro.
+ */
+extern struct aesd_buffer_entry *aesd_mpsc_circular_buffer_entry_at(
+    struct aesd_mpsc_circular_buffer *buffer,
+    size_t pos);
+
+/*
+ * Visits published entries oldest first. index is a size_t holding the
+ * absolute position, not a slot number as in AESD_CIRCULAR_BUFFER_FOREACH.
+ */
+#define AESD_MPSC_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
+    for(index=atomic_load_explicit(&(buffer)->out_pos, memory_order_relaxed); \
+            (entryptr=aesd_mpsc_circular_buffer_entry_at(buffer, index)) != NULL; \
+            index++)
+
+#endif /* AESD_CIRCULAR_BUFFER_MPSC_H */
@@ -0,0 +1,95 @@
+/**
+* @file aesd-circular-buffer-soa.c
+* @brief Struct-of-arrays aesd circular buffer with caller-sized storage
+*/
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+#include "aesd-circular-buffer-soa.h"
+
+void aesd_soa_circular_buffer_init(struct aesd_soa_circular_buffer *buffer,
+    size_t *sizes, const char **buffptrs, size_t capacity)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->sizes = sizes;
+    buffer->buffptrs = buffptrs;
+    buffer->capacity = capacity;
+}
+
+bool aesd_soa_circular_buffer_add_entry(
+    struct aesd_soa_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry,
+    struct aesd_buffer_entry *evicted)
+{
+    size_t in_offs;
+    bool full;
+
+    if (buffer == NULL || add_entry == NULL || buffer->capacity == 0)
+        return false;
+
+    full = buffer->count == buffer->capacity;
+    in_offs = buffer->out_offs + buffer->count;
+    if (in_offs >= buffer->capacity)
+        in_offs -= buffer->capacity;
+
+    if (full) {
+        if (evicted != NULL) {
+            evicted->buffptr = buffer->buffptrs[in_offs];
+            evicted->size = buffer->sizes[in_offs];
+        }
+        buffer->total_size -= buffer->sizes[in_offs];
+        buffer->out_offs = in_offs + 1 == buffer->capacity ? 0 : in_offs + 1;
+    } else {
+        buffer->count++;
+    }
+
+    buffer->sizes[in_offs] = add_entry->size;
+    buffer->buffptrs[in_offs] = add_entry->buffptr;
+    buffer->total_size += add_entry->size;
+
+    return full;
+}
+
+size_t aesd_soa_circular_buffer_find_entry_offset_for_fpos(
+    const struct aesd_soa_circular_buffer *buffer,
+    size_t char_offset,
+    size_t *entry_offset_byte_rtn)
+{
+    const size_t *sizes;
+    size_t first_run, slot, end;
+
+    if (buffer == NULL || entry_offset_byte_rtn == NULL ||
+        char_offset >= buffer->total_size)
+        return AESD_SOA_NO_ENTRY;
+
+    /*
+     * Walk the stored entries as at most two contiguous runs, out_offs to
+     * the end of the array and then from slot 0, so the loop needs no
+     * wraparound test and only ever reads sizes.
+     */
+    sizes = buffer->sizes;
+    first_run = buffer->capacity - buffer->out_offs;
+    if (first_run > buffer->count)
+        first_run = buffer->count;
+
+    for (slot = buffer->out_offs, end = slot + first_run; slot < end; slot++) {
+        if (char_offset < sizes[slot]) {
+            *entry_offset_byte_rtn = char_offset;
+            return slot;
+        }
+        char_offset -= sizes[slot];
+    }
+    for (slot = 0, end = buffer->count - first_run; slot < end; slot++) {
+        if (char_offset < sizes[slot]) {
+            *entry_offset_byte_rtn = char_offset;
+            return slot;
+        }
+        char_offset -= sizes[slot];
+    }
+
+    /* Unreachable while total_size matches the stored sizes */
+    return AESD_SOA_NO_ENTRY;
+}
@@ -0,0 +1,75 @@
+/*
+* aesd-circular-buffer-soa.h
+*
+*  @brief Struct-of-arrays layout of the aesd circular buffer for large rings.
+*
+*  struct aesd_circular_buffer keeps each pointer next to its size, so an
+*  offset lookup pulls a pointer into cache for every size it sums. Here the
+*  sizes live in their own cache-line-aligned array and occupancy is an
+*  explicit count, so find_entry_offset_for_fpos() streams through sizes
+*  alone. Storage is supplied by the caller, letting one implementation
+*  serve any capacity in the kernel or in userspace.
+*/
+
+#ifndef AESD_CIRCULAR_BUFFER_SOA_H
+#define AESD_CIRCULAR_BUFFER_SOA_H
+
+#include "aesd-circular-buffer.h"
+
+#define AESD_SOA_CACHELINE_SIZE 64
+
+/**
+ * Returned by aesd_soa_circular_buffer_find_entry_offset_for_fpos() when
+ * the offset is past the end of the stored data
+ */
+#define AESD_SOA_NO_ENTRY ((size_t)-1)
+
+struct aesd_soa_circular_buffer
+{
+    /* Everything an offset scan reads, on one cache line */
+    size_t *sizes;              /* capacity elements, cache line aligned */
+    size_t capacity;
+    size_t out_offs;            /* Slot of the oldest entry */
+    size_t count;               /* Number of stored entries */
+    size_t total_size;          /* Sum of sizes of all stored entries */
+    /* Only touched once a slot has been found */
+    const char **buffptrs;      /* capacity elements */
+} __attribute__((aligned(AESD_SOA_CACHELINE_SIZE)));
+
+/**
+ * Sets up buffer over caller-owned arrays of capacity elements. sizes should
+ * be aligned to AESD_SOA_CACHELINE_SIZE for scans to start on a line boundary.
+ */
+extern void aesd_soa_circular_buffer_init(struct aesd_soa_circular_buffer *buffer,
+    size_t *sizes, const char **buffptrs, size_t capacity);
+
+/**
+ * Adds entry to buffer, overwriting the oldest entry if the buffer is full.
+ * Returns true and copies the overwritten entry's buffptr and size to evicted
+ * (which may be NULL) if an entry was overwritten, so the caller can free it.
+ */
+extern bool aesd_soa_circular_buffer_add_entry(
+    struct aesd_soa_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry,
+    struct aesd_buffer_entry *evicted);
+
+/**
+ * Returns the slot holding the byte at char_offset, counting from the oldest
+ * entry, and sets entry_offset_byte_rtn to the offset within that entry.
+ * Returns AESD_SOA_NO_ENTRY if char_offset is past the stored data.
+ */
+extern size_t aesd_soa_circular_buffer_find_entry_offset_for_fpos(
+    const struct aesd_soa_circular_buffer *buffer,
+    size_t char_offset,
+    size_t *entry_offset_byte_rtn);
+
+/*
+ * Visits stored entries oldest first. slot is the index into sizes and
+ * buffptrs, index counts from 0 to count - 1.
+ */
+#define AESD_SOA_CIRCULAR_BUFFER_FOREACH(slot,buffer,index) \
+    for(index=0, slot=(buffer)->out_offs; \
+            index<(buffer)->count; \
+            index++, slot=(slot + 1 == (buffer)->capacity ? 0 : slot + 1))
+
+#endif /* AESD_CIRCULAR_BUFFER_SOA_H */
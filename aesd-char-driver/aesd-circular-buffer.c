@@ -65,12 +65,16 @@ const struct aesd_buffer_entry *aesd_circular_buffer_add_entry(
     /* If full, save evicted entry info BEFORE overwriting */
     if (buffer->full) {
         evicted = &buffer->entry[buffer->in_offs];
+        buffer->total_size -= evicted->size;
+        buffer->stored_size -= evicted->stored_size;
         buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
     }
 
     /* Write new entry */
     buffer->entry[buffer->in_offs] = *add_entry;
     buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->total_size += add_entry->size;
+    buffer->stored_size += add_entry->stored_size;
 
     /* Mark full if in_offs catches out_offs */
     if (buffer->in_offs == buffer->out_offs)
@@ -79,6 +83,56 @@ const struct aesd_buffer_entry *aesd_circular_buffer_add_entry(
     return evicted;
 }
 
+bool aesd_circular_buffer_remove_entry(
+    struct aesd_circular_buffer *buffer,
+    struct aesd_buffer_entry *removed)
+{
+    if (buffer == NULL || removed == NULL)
+        return false;
+
+    if (!buffer->full && buffer->out_offs == buffer->in_offs)
+        return false;
+
+    *removed = buffer->entry[buffer->out_offs];
+    memset(&buffer->entry[buffer->out_offs], 0, sizeof(*removed));
+    buffer->total_size -= removed->size;
+    buffer->stored_size -= removed->stored_size;
+    buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->full = false;
+
+    return true;
+}
+
+/**
+ * Adds entry to buffer, evicting the oldest entries until it fits within
+ * max_bytes as well as within the entry count. Evicted entries are copied
+ * out in age order. Returns the number of entries evicted.
+ */
+uint8_t aesd_circular_buffer_add_entry_bounded(
+    struct aesd_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry,
+    size_t max_bytes,
+    struct aesd_buffer_entry *evicted)
+{
+    uint8_t count = 0;
+
+    if (buffer == NULL || add_entry == NULL || evicted == NULL)
+        return 0;
+
+    if (max_bytes != 0) {
+        while (buffer->stored_size + add_entry->stored_size > max_bytes &&
+               aesd_circular_buffer_remove_entry(buffer, &evicted[count]))
+            count++;
+    }
+
+    /* add_entry() returns the slot it has already overwritten, so copy first */
+    if (buffer->full)
+        evicted[count++] = buffer->entry[buffer->in_offs];
+    aesd_circular_buffer_add_entry(buffer, add_entry);
+
+    return count;
+}
+
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer, 0, sizeof(struct aesd_circular_buffer));
@@ -22,6 +22,9 @@ struct aesd_buffer_entry
 {
     const char *buffptr;
     size_t size;
+    size_t stored_size;     /* Bytes held at buffptr, less than size if compressed */
+    uint64_t seq;           /* Monotonic sequence number assigned by the driver */
+    uint64_t timestamp_ns;  /* Ingest time, CLOCK_REALTIME */
 };
 
 struct aesd_circular_buffer
@@ -30,6 +33,8 @@ struct aesd_circular_buffer
     uint8_t in_offs;
     uint8_t out_offs;
     bool full;
+    size_t total_size;      /* Sum of the sizes of all stored entries */
+    size_t stored_size;     /* Sum of the stored_size of all stored entries */
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
@@ -45,6 +50,27 @@ extern const struct aesd_buffer_entry *aesd_circular_buffer_add_entry(
     struct aesd_circular_buffer *buffer,
     const struct aesd_buffer_entry *add_entry);
 
+/**
+ * Adds entry to buffer like aesd_circular_buffer_add_entry(), first removing
+ * as many of the oldest entries as needed to keep stored_size within max_bytes
+ * (0 for no limit). Every removed entry is copied to evicted, which must have
+ * room for AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries, so the caller can
+ * free its memory. Returns the number of entries removed.
+ */
+extern uint8_t aesd_circular_buffer_add_entry_bounded(
+    struct aesd_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry,
+    size_t max_bytes,
+    struct aesd_buffer_entry *evicted);
+
+/**
+ * Removes the oldest entry from buffer and copies it to removed.
+ * Returns false if the buffer was empty.
+ */
+extern bool aesd_circular_buffer_remove_entry(
+    struct aesd_circular_buffer *buffer,
+    struct aesd_buffer_entry *removed);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
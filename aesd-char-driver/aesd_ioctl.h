@@ -33,14 +33,204 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * Number of write commands the device stores, matches
+ * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED in the driver
+ */
+#define AESDCHAR_MAX_ENTRIES 10
+
+/**
+ * Location of one stored write command, as returned by AESDCHAR_IOCGETINDEX
+ */
+struct aesd_index_entry {
+    /**
+     * File position of the first byte of the command
+     */
+    uint64_t offset;
+    /**
+     * Length of the command in bytes
+     */
+    uint64_t size;
+    /**
+     * Sequence number of the command, increases by one per command written
+     */
+    uint64_t seq;
+    /**
+     * Time the command was committed, CLOCK_REALTIME in nanoseconds
+     */
+    uint64_t timestamp_ns;
+};
+
+/**
+ * Filled in by AESDCHAR_IOCGETINDEX with every stored command, oldest first
+ */
+struct aesd_index {
+    /**
+     * Number of valid elements in @entry
+     */
+    uint32_t entry_count;
+    uint32_t reserved;
+    /**
+     * Sum of all entry sizes
+     */
+    uint64_t total_size;
+    /**
+     * Sequence number the next command written will get
+     */
+    uint64_t next_seq;
+    struct aesd_index_entry entry[AESDCHAR_MAX_ENTRIES];
+};
+
+/**
+ * Passed to AESDCHAR_IOCREADRANGE to seek and read in a single call
+ */
+struct aesd_readrange {
+    /**
+     * The zero referenced write command to start reading from
+     */
+    uint32_t write_cmd;
+    /**
+     * The zero referenced offset within the write
+     */
+    uint32_t write_cmd_offset;
+    /**
+     * Address of the user buffer to fill
+     */
+    uint64_t buf;
+    /**
+     * Size of the user buffer
+     */
+    uint64_t len;
+    /**
+     * Set by the driver to the number of bytes copied
+     */
+    uint64_t bytes_read;
+};
+
+/**
+ * Passed to AESDCHAR_IOCREADSINCE to fetch only commands not seen yet
+ */
+struct aesd_readsince {
+    /**
+     * In: sequence number of the first command wanted, 0 for everything.
+     * Out: cursor to pass on the next call
+     */
+    uint64_t cursor;
+    /**
+     * Address of the user buffer to fill with whole commands
+     */
+    uint64_t buf;
+    /**
+     * In: size of the user buffer.
+     * Out on EMSGSIZE: size of the command that did not fit
+     */
+    uint64_t len;
+    /**
+     * Set by the driver to the number of bytes copied
+     */
+    uint64_t bytes_read;
+    /**
+     * Set by the driver to the number of commands copied
+     */
+    uint32_t entries_read;
+    uint32_t reserved;
+    /**
+     * Set by the driver to the number of commands at or after the cursor
+     * that were evicted before they could be returned
+     */
+    uint64_t lost;
+};
+
+/**
+ * Filled in by AESDCHAR_IOCGETUSAGE with the memory held by stored commands
+ */
+struct aesd_usage {
+    /**
+     * Number of commands stored
+     */
+    uint32_t entry_count;
+    /**
+     * Maximum number of commands the device keeps
+     */
+    uint32_t max_entries;
+    /**
+     * Sum of all entry sizes
+     */
+    uint64_t bytes_used;
+    /**
+     * Kernel memory backing the stored commands, rounded up to whole pages
+     * unless the driver stores commands compressed
+     */
+    uint64_t bytes_allocated;
+    /**
+     * Byte budget enforced on bytes_stored, 0 if only the entry count limits it
+     */
+    uint64_t max_bytes;
+    /**
+     * Sum of the stored entry sizes, less than bytes_used if compressed
+     */
+    uint64_t bytes_stored;
+};
+
+/**
+ * Location of one stored write command within an mmap() of the device
+ */
+struct aesd_mmap_entry {
+    /**
+     * Byte offset of the command from the start of the mapping, always page aligned
+     */
+    uint64_t offset;
+    /**
+     * Length of the command in bytes
+     */
+    uint64_t size;
+};
+
+/**
+ * Layout of the first page of an mmap() of the aesdchar device. Stored commands
+ * follow in read order. Read @sequence before and after using the header or
+ * entry data and retry if it was odd or has changed.
+ */
+struct aesd_mmap_header {
+    /**
+     * Odd while the driver is updating the mapping
+     */
+    uint32_t sequence;
+    /**
+     * Number of valid elements in @entry, oldest first
+     */
+    uint32_t entry_count;
+    /**
+     * Sum of all entry sizes, the same number of bytes read() would return
+     */
+    uint64_t total_size;
+    /**
+     * Length of mapping needed to cover every entry
+     */
+    uint64_t map_size;
+    struct aesd_mmap_entry entry[AESDCHAR_MAX_ENTRIES];
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Pass a non-zero uint32_t to make read() on this file descriptor wait for new
+// commands at the end of data (tail -f style) instead of returning 0
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+// Return the offsets and sizes of all stored commands
+#define AESDCHAR_IOCGETINDEX _IOR(AESD_IOC_MAGIC, 3, struct aesd_index)
+// Seek like AESDCHAR_IOCSEEKTO, then read into the supplied buffer
+#define AESDCHAR_IOCREADRANGE _IOWR(AESD_IOC_MAGIC, 4, struct aesd_readrange)
+// Read whole commands newer than a cursor, fails with EMSGSIZE if the buffer
+// cannot hold the first one, after reporting its size in len
+#define AESDCHAR_IOCREADSINCE _IOWR(AESD_IOC_MAGIC, 5, struct aesd_readsince)
+// Report how much memory the stored commands use against the configured limits
+#define AESDCHAR_IOCGETUSAGE _IOR(AESD_IOC_MAGIC, 6, struct aesd_usage)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 6
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,62 @@
+/*
+ * aesd_trace.h
+ *
+ *  @brief Tracepoints for the aesdchar read and write paths, available under
+ *  events/aesdchar/ in tracefs and to perf. Disabled tracepoints cost a
+ *  patched-out branch.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(aesd_write,
+    TP_PROTO(unsigned int minor, size_t count, size_t partial_size, ssize_t ret),
+    TP_ARGS(minor, count, partial_size, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(size_t, partial_size)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->partial_size = partial_size;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u count=%zu partial=%zu ret=%zd",
+              __entry->minor, __entry->count, __entry->partial_size, __entry->ret)
+);
+
+TRACE_EVENT(aesd_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u pos=%lld count=%zu ret=%zd",
+              __entry->minor, __entry->pos, __entry->count, __entry->ret)
+);
+
+#endif /* AESD_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesd_trace
+#include <trace/define_trace.h>
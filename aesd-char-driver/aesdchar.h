@@ -8,7 +8,7 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug, or build with DEBUG=y
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -23,17 +23,110 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+#include <linux/llist.h>
 #include <linux/mutex.h>
+#include <linux/srcu.h>
+#include <linux/wait.h>
 #include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
+
+/*
+ * Per-CPU event counters, summed when read through debugfs
+ */
+struct aesd_stats
+{
+    u64 commands_written;                 /* Commands committed to the ring */
+    u64 bytes_written;                    /* Bytes accepted by write() */
+    u64 evictions;                        /* Commands dropped to make room */
+    u64 partial_hwm;                      /* Largest unterminated buffer seen */
+    u64 read_calls;                       /* Calls to read() */
+    u64 bytes_read;                       /* Bytes returned by read() */
+    u64 lock_acquisitions;                /* Times writers took dev->lock */
+    u64 lock_wait_ns;                     /* Time writers spent waiting for their commit */
+    u64 combined;                         /* Commits done by another writer's pass */
+};
+
+/*
+ * A published, read-only snapshot of the circular buffer. Writers copy the
+ * current table, add their entry to the copy and swap the pointer; readers
+ * traverse whichever table they found under srcu_read_lock() without taking
+ * the device mutex.
+ */
+struct aesd_ring
+{
+    struct aesd_circular_buffer buffer;   /* Entry table seen by readers */
+    loff_t base;                          /* Bytes evicted before the oldest entry */
+    uint64_t next_seq;                    /* Sequence number of the next command */
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+                                          /* Entries dropped when this table was replaced */
+    uint8_t evicted_count;                /* Number of valid elements in evicted */
+    struct rcu_head rcu;                  /* Deferred free after an SRCU grace period */
+};
 
 struct aesd_dev
 {
-    struct aesd_circular_buffer buffer;   /* Circular buffer for storing write commands */
-    char *partial_write_buf;              /* Buffer for incomplete (no \n) write data */
+    struct aesd_ring __rcu *ring;         /* Current circular buffer of write commands */
+    char *partial_write_buf;              /* Incomplete (no \n) data left by closed files */
     size_t partial_write_size;            /* Size of partial write data */
-    struct mutex lock;                    /* Mutex for thread-safe access */
+    struct mutex lock;                    /* Serializes ring commits and partial_write_buf */
+    struct srcu_struct srcu;              /* Read side protection for ring */
+    struct aesd_mmap_header *mmap_header; /* Page shared read-only with mmap() users */
+    wait_queue_head_t read_queue;         /* Readers waiting for a new command */
+    struct llist_head commit_queue;       /* Pending aesd_commit_req, newest first */
+    wait_queue_head_t combine_wait;       /* Writers waiting for their request or the lock */
+    int node;                             /* NUMA node the device state lives on */
+    size_t max_bytes;                     /* Byte budget for stored commands, 0 for none */
+    struct aesd_stats __percpu *stats;    /* Instrumentation, see debugfs aesdchar/aesdcharN/stats */
     struct cdev cdev;                     /* Char device structure */
 };
 
+/*
+ * A batch of commands waiting on aesd_dev.commit_queue until whichever
+ * writer holds dev->lock publishes it, together with everything else
+ * queued, as a single ring table. Lives on the submitter's stack.
+ */
+struct aesd_commit_req
+{
+    struct llist_node node;               /* Link in aesd_dev.commit_queue */
+    struct aesd_file *priv;               /* Submitting file, its lock is held throughout */
+    struct aesd_buffer_entry *entries;    /* Commands, in write order */
+    size_t count;                         /* Number of elements in entries */
+    struct aesd_ring *new_ring;           /* Preallocated table, NULL once used */
+    struct aesd_buffer_entry stale_entry; /* First command before device leftovers were joined on */
+    char *stale_partial;                  /* Device leftovers consumed or dropped by the join */
+    size_t nr_dead;                       /* Leading entries evicted before being published */
+    int retval;                           /* Result, valid once done */
+    bool done;                            /* Set with release semantics when processed */
+};
+
+#define AESD_DECOMP_CACHE_ENTRIES 2
+
+/*
+ * A decompressed copy of a stored entry, identified by its sequence number
+ */
+struct aesd_decomp_cache
+{
+    uint64_t seq;                         /* Sequence number of the cached entry */
+    char *data;                           /* Uncompressed bytes, NULL if the slot is unused */
+};
+
+/*
+ * Per-open state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;                 /* Device this file was opened on */
+    char *partial_write_buf;              /* Incomplete (no \n) data written through this file */
+    size_t partial_write_size;            /* Size of partial write data */
+    struct mutex lock;                    /* Serializes writers on this file */
+    void *lz4_wrkmem;                     /* LZ4 compression state, allocated on first commit */
+    bool follow;                          /* Block at end of data instead of returning EOF */
+    loff_t base;                          /* aesd_ring.base that f_pos is relative to when following */
+    struct mutex cache_lock;              /* Serializes readers using cache */
+    struct aesd_decomp_cache cache[AESD_DECOMP_CACHE_ENTRIES];
+                                          /* Recently decompressed entries */
+    uint8_t cache_next;                   /* Slot replaced by the next cache miss */
+};
+
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
\ No newline at end of file
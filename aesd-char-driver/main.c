@@ -19,322 +19,1495 @@
 #include <linux/fs.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/string.h>
+#include <linux/rcupdate.h>
+#include <linux/srcu.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/moduleparam.h>
+#include <linux/nodemask.h>
+#include <linux/err.h>
+#include <linux/timekeeping.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/lz4.h>
+#include <linux/llist.h>
 #include "aesdchar.h"
 
 #include "aesd_ioctl.h"
 
+#define CREATE_TRACE_POINTS
+#include "aesd_trace.h"
+
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
+int aesd_nr_devs = 1; // number of independent minors, /dev/aesdchar0..N-1
+unsigned long aesd_max_bytes = 0; // byte budget per device, 0 for count-only eviction
+bool aesd_compress = false; // store commands LZ4 compressed, disables mmap
+
+module_param(aesd_nr_devs, int, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of aesdchar devices to create");
+module_param(aesd_max_bytes, ulong, S_IRUGO);
+MODULE_PARM_DESC(aesd_max_bytes, "Maximum bytes of commands each device stores, after compression with aesd_compress, 0 for no limit");
+module_param(aesd_compress, bool, S_IRUGO);
+MODULE_PARM_DESC(aesd_compress, "Compress stored commands with LZ4 (mmap is unavailable)");
 
 MODULE_AUTHOR("Omkar Sangrulkar");
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev **aesd_devices;
+static struct dentry *aesd_debugfs_root;
+
+/*
+ * Command storage is page backed so that entries can be mapped straight
+ * into userspace by aesd_mmap(). Pages are zeroed so the unused tail of
+ * the last page never exposes stale kernel memory. Compressed storage is
+ * never mapped, so it is packed tightly instead.
+ */
+static char *aesd_entry_alloc(struct aesd_dev *dev, size_t size)
+{
+    if (aesd_compress)
+        return kvmalloc_node(size, GFP_KERNEL, dev->node);
+    return alloc_pages_exact_nid(dev->node, PAGE_ALIGN(size), GFP_KERNEL | __GFP_ZERO);
+}
+
+static void aesd_entry_free(const struct aesd_buffer_entry *entry)
+{
+    if (!entry->buffptr)
+        return;
+    if (aesd_compress)
+        kvfree(entry->buffptr);
+    else
+        free_pages_exact((void *)entry->buffptr, PAGE_ALIGN(entry->stored_size));
+}
+
+/* LZ4 never shrinks its input by more than this factor */
+#define AESD_LZ4_MAX_RATIO 255
+
+/*
+ * The budget counts stored bytes, so with compression a command is only
+ * known to fit once it has been compressed. Returns the longest raw command
+ * that might still fit, for checks made before that.
+ */
+static size_t aesd_raw_budget(const struct aesd_dev *dev)
+{
+    if (!aesd_compress || dev->max_bytes > SIZE_MAX / AESD_LZ4_MAX_RATIO)
+        return dev->max_bytes;
+    return dev->max_bytes * AESD_LZ4_MAX_RATIO;
+}
+
+/*
+ * Fills in @entry with a stored copy of @head followed by @tail. With
+ * aesd_compress set the copy is LZ4 compressed using @wrkmem, unless that
+ * would not save any space.
+ */
+static int aesd_entry_build(struct aesd_dev *dev, void *wrkmem,
+                            struct aesd_buffer_entry *entry,
+                            const char *head, size_t head_len,
+                            const char *tail, size_t tail_len)
+{
+    size_t len = head_len + tail_len;
+    const char *src = tail;
+    char *scratch = NULL;
+    int packed_len = 0;
+    char *buf;
+
+    if (aesd_compress) {
+        int bound = LZ4_compressBound(len);
+
+        /* Compressed output first, then the joined input if there is a head */
+        scratch = kvmalloc(bound + (head_len ? len : 0), GFP_KERNEL);
+        if (!scratch)
+            return -ENOMEM;
+        if (head_len) {
+            memcpy(scratch + bound, head, head_len);
+            memcpy(scratch + bound + head_len, tail, tail_len);
+            src = scratch + bound;
+        }
+        packed_len = LZ4_compress_default(src, scratch, len, bound, wrkmem);
+    }
+
+    entry->size = len;
+    entry->stored_size = packed_len > 0 && (size_t)packed_len < len ? (size_t)packed_len : len;
+    buf = aesd_entry_alloc(dev, entry->stored_size);
+    if (!buf) {
+        kvfree(scratch);
+        return -ENOMEM;
+    }
+    if (entry->stored_size < len) {
+        memcpy(buf, scratch, entry->stored_size);
+    } else {
+        /* head is NULL when there is nothing to join */
+        if (head_len)
+            memcpy(buf, head, head_len);
+        memcpy(buf + head_len, tail, tail_len);
+    }
+    entry->buffptr = buf;
+    kvfree(scratch);
+    return 0;
+}
+
+/*
+ * Takes priv->cache_lock if @entry is compressed. Raw entries are read in
+ * place and never touch the decompression cache.
+ */
+static void aesd_entry_lock(struct aesd_file *priv, const struct aesd_buffer_entry *entry)
+{
+    if (entry->stored_size != entry->size)
+        mutex_lock(&priv->cache_lock);
+}
+
+static void aesd_entry_unlock(struct aesd_file *priv, const struct aesd_buffer_entry *entry)
+{
+    if (entry->stored_size != entry->size)
+        mutex_unlock(&priv->cache_lock);
+}
+
+/*
+ * Returns the uncompressed contents of @entry. Compressed entries are
+ * decompressed into a small per-file cache keyed by sequence number, so
+ * the result is only valid between aesd_entry_lock() and aesd_entry_unlock().
+ */
+static const char *aesd_entry_data(struct aesd_file *priv,
+                                   const struct aesd_buffer_entry *entry)
+{
+    struct aesd_decomp_cache *slot;
+    char *data;
+    int unpacked;
+    uint8_t i;
+
+    if (entry->stored_size == entry->size)
+        return entry->buffptr;
+
+    lockdep_assert_held(&priv->cache_lock);
+    for (i = 0; i < AESD_DECOMP_CACHE_ENTRIES; i++) {
+        if (priv->cache[i].data && priv->cache[i].seq == entry->seq)
+            return priv->cache[i].data;
+    }
+
+    data = kvmalloc(entry->size, GFP_KERNEL);
+    if (!data)
+        return ERR_PTR(-ENOMEM);
+    unpacked = LZ4_decompress_safe(entry->buffptr, data, entry->stored_size,
+                                   entry->size);
+    if (unpacked < 0 || (size_t)unpacked != entry->size) {
+        kvfree(data);
+        return ERR_PTR(-EIO);
+    }
+
+    slot = &priv->cache[priv->cache_next];
+    priv->cache_next = (priv->cache_next + 1) % AESD_DECOMP_CACHE_ENTRIES;
+    kvfree(slot->data);
+    slot->seq = entry->seq;
+    slot->data = data;
+    return data;
+}
+
+/*
+ * Rewrites the shared mmap header page from @buffer. Userspace treats
+ * header->sequence like a seqcount: it is odd while an update is in
+ * progress, and any change across a read means the snapshot is stale.
+ * Stale data page mappings are zapped before the sequence turns even again
+ * so the next access faults in the new layout.
+ */
+static void aesd_mmap_update(struct aesd_dev *dev, struct address_space *mapping,
+                             const struct aesd_circular_buffer *buffer)
+{
+    struct aesd_mmap_header *header = dev->mmap_header;
+    uint64_t map_offset = PAGE_SIZE;
+    uint64_t total_size = 0;
+    uint32_t count = 0;
+    uint8_t i;
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        if (!buffer->full && idx == buffer->in_offs)
+            break;
+        if (buffer->entry[idx].buffptr == NULL)
+            break;
+        header->entry[count].offset = map_offset;
+        header->entry[count].size = buffer->entry[idx].size;
+        map_offset += PAGE_ALIGN(buffer->entry[idx].size);
+        total_size += buffer->entry[idx].size;
+        count++;
+    }
+    header->entry_count = count;
+    header->total_size = total_size;
+    header->map_size = map_offset;
+
+    if (mapping && mapping_mapped(mapping))
+        unmap_mapping_range(mapping, PAGE_SIZE, 0, 1);
+
+    smp_wmb();
+    WRITE_ONCE(header->sequence, header->sequence + 1);
+}
+
+/*
+ * Frees a ring table once no SRCU reader can still be looking at it, along
+ * with the entries that were evicted when the table was replaced.
+ */
+static void aesd_ring_free_rcu(struct rcu_head *head)
+{
+    struct aesd_ring *ring = container_of(head, struct aesd_ring, rcu);
+    uint8_t i;
+
+    for (i = 0; i < ring->evicted_count; i++)
+        aesd_entry_free(&ring->evicted[i]);
+    kfree(ring);
+}
+
+/*
+ * Prepends unterminated data left by closed files to the first command of
+ * @req. That data is protected by dev->lock, so this is the one allocation
+ * on the commit path that cannot be made before taking it.
+ */
+static int aesd_join_partial(struct aesd_dev *dev, struct aesd_commit_req *req)
+{
+    struct aesd_buffer_entry joined;
+    int retval;
+
+    /*
+     * If the leftover would push the command over budget, discard the
+     * leftover rather than the command. Failing instead would fail every
+     * later writer too, since the leftover stays in place.
+     */
+    if (dev->max_bytes &&
+        dev->partial_write_size + req->entries[0].size > aesd_raw_budget(dev))
+        goto drop;
+
+    retval = aesd_entry_build(dev, req->priv->lz4_wrkmem, &joined,
+                              dev->partial_write_buf, dev->partial_write_size,
+                              req->priv->partial_write_buf, req->entries[0].size);
+    if (retval)
+        return retval;
+    if (dev->max_bytes && joined.stored_size > dev->max_bytes) {
+        /* Freed by the submitter along with the leftover */
+        req->stale_entry = joined;
+        goto drop;
+    }
+
+    req->stale_entry = req->entries[0];
+    req->entries[0] = joined;
+    req->stale_partial = dev->partial_write_buf;
+    dev->partial_write_buf = NULL;
+    dev->partial_write_size = 0;
+    return 0;
+
+drop:
+    printk(KERN_WARNING "aesdchar: dropping %zu unterminated bytes over budget\n",
+           dev->partial_write_size);
+    req->stale_partial = dev->partial_write_buf;
+    dev->partial_write_buf = NULL;
+    dev->partial_write_size = 0;
+    return 0;
+}
+
+/*
+ * Takes every request on dev->commit_queue and publishes all of their
+ * commands, in submission order, as one new ring table. Must be called
+ * with dev->lock held, and does nothing else that allocates or frees: the
+ * table comes preallocated with the first request, and what it replaces is
+ * handed back for the submitters to free. The previous table is left
+ * intact for readers already traversing it and is reclaimed after an SRCU
+ * grace period. @mapping is the address space whose user mappings need to
+ * be refreshed, if any; @self is the combining file.
+ *
+ * Each request is marked done once processed, after which its submitter
+ * may return and the request must not be touched. Returns true if anything
+ * was committed.
+ */
+static bool aesd_combine(struct aesd_dev *dev, struct address_space *mapping,
+                         struct aesd_file *self)
+{
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_commit_req *req;
+    struct aesd_commit_req *tmp;
+    struct llist_node *reqs;
+    struct aesd_ring *old_ring;
+    struct aesd_ring *new_ring = NULL;
+    uint64_t first_seq;
+    uint64_t oldest_seq = 0;
+    u64 now;
+    size_t n;
+    uint8_t nr_evicted;
+    uint8_t i;
+
+    reqs = llist_reverse_order(llist_del_all(&dev->commit_queue));
+    if (!reqs)
+        return false;
+
+    old_ring = rcu_dereference_protected(dev->ring, lockdep_is_held(&dev->lock));
+    first_seq = old_ring->next_seq;
+    now = ktime_get_real_ns();
+
+    llist_for_each_entry(req, reqs, node) {
+        if (dev->partial_write_size > 0) {
+            req->retval = aesd_join_partial(dev, req);
+            if (req->retval)
+                continue;
+        }
+
+        if (!new_ring) {
+            new_ring = req->new_ring;
+            req->new_ring = NULL;
+            new_ring->buffer = old_ring->buffer;
+            new_ring->base = old_ring->base;
+            new_ring->next_seq = old_ring->next_seq;
+            new_ring->evicted_count = 0;
+        }
+
+        for (n = 0; n < req->count; n++) {
+            req->entries[n].seq = new_ring->next_seq++;
+            req->entries[n].timestamp_ns = now;
+
+            nr_evicted = aesd_circular_buffer_add_entry_bounded(&new_ring->buffer,
+                                                                &req->entries[n],
+                                                                dev->max_bytes,
+                                                                evicted);
+            for (i = 0; i < nr_evicted; i++) {
+                new_ring->base += evicted[i].size;
+                /* Older entries only survive in old_ring from here on */
+                if (evicted[i].seq < first_seq)
+                    old_ring->evicted[old_ring->evicted_count++] = evicted[i];
+            }
+            this_cpu_add(dev->stats->evictions, nr_evicted);
+        }
+        this_cpu_add(dev->stats->commands_written, req->count);
+        if (req->priv != self)
+            this_cpu_inc(dev->stats->combined);
+    }
+
+    if (new_ring) {
+        oldest_seq = new_ring->buffer.entry[new_ring->buffer.out_offs].seq;
+
+        /* Mark the mmap header as in flux before readers can see the new table */
+        WRITE_ONCE(dev->mmap_header->sequence, dev->mmap_header->sequence + 1);
+        smp_wmb();
+        rcu_assign_pointer(dev->ring, new_ring);
+        aesd_mmap_update(dev, mapping, &new_ring->buffer);
+
+        call_srcu(&dev->srcu, &old_ring->rcu, aesd_ring_free_rcu);
+    }
+
+    llist_for_each_entry_safe(req, tmp, reqs, node) {
+        /* Eviction is FIFO, so a request's unpublished entries lead its batch */
+        if (!req->retval && oldest_seq > req->entries[0].seq)
+            req->nr_dead = min_t(size_t, oldest_seq - req->entries[0].seq, req->count);
+        smp_store_release(&req->done, true);
+    }
+    return new_ring != NULL;
+}
+
+/*
+ * Returns the number of bytes readable from @buffer, i.e. the size reported
+ * to llseek(SEEK_END).
+ */
+static loff_t aesd_buffer_total_size(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->total_size;
+}
+
+/*
+ * Returns true if there is data stored beyond file position @pos of
+ * @priv. Safe to use as a wait_event() condition since it never sleeps.
+ */
+static bool aesd_data_available(struct aesd_file *priv, loff_t pos)
+{
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_ring *ring;
+    loff_t start;
+    loff_t end;
+    int srcu_idx;
+
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    ring = srcu_dereference(dev->ring, &dev->srcu);
+    /* A following reader's position is pinned to the stream, see aesd_read() */
+    start = priv->follow ? priv->base : ring->base;
+    end = ring->base + aesd_buffer_total_size(&ring->buffer);
+    srcu_read_unlock(&dev->srcu, srcu_idx);
+
+    return start + pos < end;
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
-    struct aesd_dev *dev;
+    struct aesd_file *priv;
     PDEBUG("open");
-    dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+    if (!priv)
+        return -ENOMEM;
+    priv->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    mutex_init(&priv->lock);
+    mutex_init(&priv->cache_lock);
+    filp->private_data = priv;
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    char *new_partial;
+    char *dropped = NULL;
+    uint8_t i;
+
     PDEBUG("release");
-    /* Nothing to do here, no per-open state allocated */
+
+    /*
+     * Hand unterminated data over to the device so the next command written
+     * through any file completes it.
+     */
+    if (priv->partial_write_size > 0) {
+        mutex_lock(&dev->lock);
+        if (dev->max_bytes &&
+            dev->partial_write_size + priv->partial_write_size > aesd_raw_budget(dev)) {
+            /* No command completing this run could be stored, so keep none of it */
+            printk(KERN_WARNING "aesdchar: dropping %zu unterminated bytes over budget\n",
+                   dev->partial_write_size + priv->partial_write_size);
+            dropped = dev->partial_write_buf;
+            dev->partial_write_buf = NULL;
+            dev->partial_write_size = 0;
+        } else {
+            new_partial = krealloc(dev->partial_write_buf,
+                                   dev->partial_write_size + priv->partial_write_size,
+                                   GFP_KERNEL);
+            if (new_partial) {
+                memcpy(new_partial + dev->partial_write_size,
+                       priv->partial_write_buf, priv->partial_write_size);
+                dev->partial_write_buf = new_partial;
+                dev->partial_write_size += priv->partial_write_size;
+            } else {
+                printk(KERN_WARNING "aesdchar: dropping %zu unterminated bytes\n",
+                       priv->partial_write_size);
+            }
+        }
+        mutex_unlock(&dev->lock);
+        /* Writers queued meanwhile wait for the lock to be free again */
+        wake_up_all(&dev->combine_wait);
+        kfree(dropped);
+    }
+
+    for (i = 0; i < AESD_DECOMP_CACHE_ENTRIES; i++)
+        kvfree(priv->cache[i].data);
+    kvfree(priv->lz4_wrkmem);
+    kfree(priv->partial_write_buf);
+    mutex_destroy(&priv->cache_lock);
+    mutex_destroy(&priv->lock);
+    kfree(priv);
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+/*
+ * Copies as much of the stream as fits in @to, crossing entry boundaries,
+ * from a single ring snapshot. Backs read(), readv() and splice() alike.
+ */
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
     ssize_t retval = 0;
-    struct aesd_dev *dev = filp->private_data;
+    struct file *filp = iocb->ki_filp;
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_ring *ring;
     struct aesd_buffer_entry *entry;
+    const char *data;
+    size_t count = iov_iter_count(to);
     size_t entry_offset = 0;
     size_t bytes_to_copy;
+    size_t copied;
+    int srcu_idx;
 
-    PDEBUG("read %zu bytes with offset %lld", count, *f_pos);
+    PDEBUG("read %zu bytes with offset %lld", count, iocb->ki_pos);
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+    if (count == 0)
+        goto done;
 
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer,
-                                                             *f_pos,
-                                                             &entry_offset);
-    if (entry == NULL) {
-        /* No data available at this offset */
-        retval = 0;
-        goto out;
+retry:
+    /* Readers never take dev->lock, they only pin the current ring table */
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    ring = srcu_dereference(dev->ring, &dev->srcu);
+
+    /*
+     * When following, keep ki_pos pointing at the same stream byte as
+     * older commands are evicted from the front of the ring.
+     */
+    if (priv->follow) {
+        loff_t shift = ring->base - priv->base;
+
+        iocb->ki_pos = iocb->ki_pos > shift ? iocb->ki_pos - shift : 0;
+        priv->base = ring->base;
     }
 
-    /* How many bytes available in this entry from entry_offset */
-    bytes_to_copy = entry->size - entry_offset;
+    while (iov_iter_count(to) > 0) {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&ring->buffer,
+                                                                 iocb->ki_pos,
+                                                                 &entry_offset);
+        if (entry == NULL)
+            break;
 
-    /* Limit to what caller requested */
-    if (bytes_to_copy > count)
-        bytes_to_copy = count;
+        aesd_entry_lock(priv, entry);
+        data = aesd_entry_data(priv, entry);
+        if (IS_ERR(data)) {
+            aesd_entry_unlock(priv, entry);
+            if (retval == 0)
+                retval = PTR_ERR(data);
+            break;
+        }
 
-    if (copy_to_user(buf, entry->buffptr + entry_offset, bytes_to_copy)) {
-        retval = -EFAULT;
-        goto out;
+        bytes_to_copy = min_t(size_t, entry->size - entry_offset,
+                              iov_iter_count(to));
+        copied = copy_to_iter(data + entry_offset, bytes_to_copy, to);
+        aesd_entry_unlock(priv, entry);
+        iocb->ki_pos += copied;
+        retval += copied;
+        if (copied < bytes_to_copy) {
+            if (retval == 0)
+                retval = -EFAULT;
+            break;
+        }
     }
+    srcu_read_unlock(&dev->srcu, srcu_idx);
 
-    *f_pos += bytes_to_copy;
-    retval = bytes_to_copy;
+    /* No data available at this offset, report EOF unless following */
+    if (retval == 0 && priv->follow) {
+        if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)) {
+            retval = -EAGAIN;
+            goto done;
+        }
+        if (wait_event_interruptible(dev->read_queue,
+                                     aesd_data_available(priv, iocb->ki_pos))) {
+            retval = -ERESTARTSYS;
+            goto done;
+        }
+        goto retry;
+    }
 
-out:
-    mutex_unlock(&dev->lock);
+done:
+    this_cpu_inc(dev->stats->read_calls);
+    if (retval > 0)
+        this_cpu_add(dev->stats->bytes_read, retval);
+    trace_aesd_read(MINOR(dev->cdev.dev), iocb->ki_pos, count, retval);
     return retval;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+/*
+ * Commits every complete command in @priv's partial write buffer to the
+ * ring as a single batch. Called with priv->lock held. @scan_from is the
+ * first byte not yet searched for a newline, so each byte is scanned a
+ * bounded number of times and the unterminated tail is compacted once,
+ * however many commands one write() carries.
+ *
+ * Entries and a ring table are allocated up front and the batch is queued
+ * on dev->commit_queue. If dev->lock is free this writer takes it and
+ * publishes every queued batch in one pass (flat combining); otherwise it
+ * sleeps until the current holder has published its batch for it, or the
+ * lock is released first. Whatever the commit replaces is freed here,
+ * outside the lock.
+ */
+static int aesd_commit_partial(struct aesd_file *priv, struct address_space *mapping,
+                               size_t scan_from)
 {
-    ssize_t retval = -ENOMEM;
-    struct aesd_dev *dev = filp->private_data;
-    char *kernel_buf = NULL;
-    char *newline_pos;
-    char *new_partial;
-    /* evicted handled inline in write loop */
-
-    PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_commit_req req = { .priv = priv };
+    const char *buf = priv->partial_write_buf;
+    const char *end = buf + priv->partial_write_size;
+    const char *start;
+    const char *newline_pos;
+    size_t nr_cmds = 0;
+    size_t nr_built = 0;
+    size_t consumed;
+    size_t n;
+    int retval = -ENOMEM;
+    u64 wait_start;
+
+    /* Find how many commands there are so the entry table is allocated once */
+    for (start = buf + scan_from;
+         (newline_pos = memchr(start, '\n', end - start)) != NULL;
+         start = newline_pos + 1)
+        nr_cmds++;
+    if (nr_cmds == 0)
+        return 0;
+    consumed = start - buf;
+
+    if (aesd_compress && !priv->lz4_wrkmem) {
+        priv->lz4_wrkmem = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+        if (!priv->lz4_wrkmem)
+            return -ENOMEM;
+    }
 
-    /* Copy user data into kernel buffer */
-    kernel_buf = kmalloc(count, GFP_KERNEL);
-    if (!kernel_buf)
+    req.entries = kvmalloc_array(nr_cmds, sizeof(*req.entries), GFP_KERNEL);
+    if (!req.entries)
         return -ENOMEM;
+    req.new_ring = kmalloc_node(sizeof(*req.new_ring), GFP_KERNEL, dev->node);
+    if (!req.new_ring)
+        goto out_free;
+
+    for (start = buf; nr_built < nr_cmds; nr_built++) {
+        newline_pos = memchr(start, '\n', end - start);
+        retval = aesd_entry_build(dev, priv->lz4_wrkmem, &req.entries[nr_built], NULL, 0,
+                                  start, newline_pos - start + 1); /* include \n */
+        if (retval)
+            goto out_free;
+        /* Only now is a compressed command's stored size known */
+        if (dev->max_bytes && req.entries[nr_built].stored_size > dev->max_bytes) {
+            aesd_entry_free(&req.entries[nr_built]);
+            retval = -EFBIG;
+            goto out_free;
+        }
+        start = newline_pos + 1;
+    }
+    req.count = nr_cmds;
+
+    /*
+     * Once queued the request belongs to whichever writer combines it, so
+     * from here on the wait cannot be interrupted.
+     */
+    wait_start = ktime_get_ns();
+    llist_add(&req.node, &dev->commit_queue);
+    while (!smp_load_acquire(&req.done)) {
+        if (mutex_trylock(&dev->lock)) {
+            bool committed;
+
+            this_cpu_inc(dev->stats->lock_acquisitions);
+            committed = aesd_combine(dev, mapping, priv);
+            mutex_unlock(&dev->lock);
+            wake_up_all(&dev->combine_wait);
+            if (committed)
+                wake_up_interruptible(&dev->read_queue);
+        } else {
+            wait_event(dev->combine_wait,
+                       smp_load_acquire(&req.done) || !mutex_is_locked(&dev->lock));
+        }
+    }
+    this_cpu_add(dev->stats->lock_wait_ns, ktime_get_ns() - wait_start);
+
+    retval = req.retval;
+    if (retval)
+        goto out_free;
+
+    aesd_entry_free(&req.stale_entry);
+    kfree(req.stale_partial);
+    for (n = 0; n < req.nr_dead; n++)
+        aesd_entry_free(&req.entries[n]);
+    kfree(req.new_ring);
+    kvfree(req.entries);
+
+    /* Keep only the unterminated tail */
+    priv->partial_write_size -= consumed;
+    memmove(priv->partial_write_buf, priv->partial_write_buf + consumed,
+            priv->partial_write_size);
+    return 0;
 
-    if (copy_from_user(kernel_buf, buf, count)) {
-        kfree(kernel_buf);
-        return -EFAULT;
+out_free:
+    while (nr_built-- > 0)
+        aesd_entry_free(&req.entries[nr_built]);
+    kfree(req.new_ring);
+    kvfree(req.entries);
+    return retval;
+}
+
+/*
+ * Returns true if appending @size bytes at @buf to an unterminated run of
+ * @run bytes would make any command, or the unterminated data after the
+ * last newline, longer than @max_bytes so that it could never be stored.
+ * Only the appended bytes are scanned.
+ */
+static bool aesd_over_budget(const char *buf, size_t size, size_t run, size_t max_bytes)
+{
+    const char *start = buf;
+    const char *end = buf + size;
+    const char *newline_pos;
+
+    while ((newline_pos = memchr(start, '\n', end - start)) != NULL) {
+        if (run + (newline_pos - start) + 1 > max_bytes)
+            return true;
+        run = 0;
+        start = newline_pos + 1;
     }
+    return run + (end - start) > max_bytes;
+}
+
+/*
+ * Appends every segment of @from to the per-file staging buffer and commits
+ * the complete commands it now holds, so one writev() may commit several.
+ */
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    ssize_t retval = -ENOMEM;
+    struct file *filp = iocb->ki_filp;
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_stats *stats;
+    size_t count = iov_iter_count(from);
+    size_t scan_from;
+    char *new_partial;
+
+    PDEBUG("write %zu bytes with offset %lld", count, iocb->ki_pos);
 
-    if (mutex_lock_interruptible(&dev->lock)) {
-        kfree(kernel_buf);
+    /* Fragments are staged per open file, without touching the device lock */
+    if (mutex_lock_interruptible(&priv->lock))
         return -ERESTARTSYS;
-    }
 
-    /* Append to partial write buffer */
-    new_partial = krealloc(dev->partial_write_buf,
-                           dev->partial_write_size + count,
+    /* Append to partial write buffer, copying straight from the iterator */
+    scan_from = priv->partial_write_size;
+    new_partial = krealloc(priv->partial_write_buf,
+                           priv->partial_write_size + count,
                            GFP_KERNEL);
     if (!new_partial) {
-        kfree(kernel_buf);
         retval = -ENOMEM;
         goto out;
     }
+    priv->partial_write_buf = new_partial;
 
-    dev->partial_write_buf = new_partial;
-    memcpy(dev->partial_write_buf + dev->partial_write_size, kernel_buf, count);
-    dev->partial_write_size += count;
-    kfree(kernel_buf);
-    kernel_buf = NULL;
+    if (!copy_from_iter_full(priv->partial_write_buf + priv->partial_write_size,
+                             count, from)) {
+        retval = -EFAULT;
+        goto out;
+    }
 
-    /* Check if we have a complete command (terminated by \n) */
-    newline_pos = memchr(dev->partial_write_buf, '\n', dev->partial_write_size);
+    /*
+     * Refuse the whole write rather than store a command the budget cannot
+     * hold. What is already staged never contains a newline, so it is one
+     * unterminated run of scan_from bytes.
+     */
+    if (dev->max_bytes &&
+        aesd_over_budget(priv->partial_write_buf + scan_from, count, scan_from,
+                         aesd_raw_budget(dev))) {
+        retval = -EFBIG;
+        goto out;
+    }
+    priv->partial_write_size += count;
+
+    stats = get_cpu_ptr(dev->stats);
+    if (priv->partial_write_size > stats->partial_hwm)
+        stats->partial_hwm = priv->partial_write_size;
+    put_cpu_ptr(dev->stats);
+
+    /* Commit any complete commands (terminated by \n), only new bytes can end one */
+    retval = aesd_commit_partial(priv, filp->f_mapping, scan_from);
+    if (retval) {
+        /*
+         * The write fails as a whole, so drop its bytes again. Leaving its
+         * newlines staged would also break the next scan, which assumes
+         * none before scan_from.
+         */
+        priv->partial_write_size = scan_from;
+        goto out;
+    }
 
-    while (newline_pos != NULL) {
-        size_t cmd_len = newline_pos - dev->partial_write_buf + 1; /* include \n */
-        struct aesd_buffer_entry new_entry;
-        char *cmd_buf;
+    retval = count;
+    this_cpu_add(dev->stats->bytes_written, count);
 
-        cmd_buf = kmalloc(cmd_len, GFP_KERNEL);
-        if (!cmd_buf) {
-            retval = -ENOMEM;
-            goto out;
-        }
-        memcpy(cmd_buf, dev->partial_write_buf, cmd_len);
+out:
+    trace_aesd_write(MINOR(dev->cdev.dev), count, priv->partial_write_size, retval);
+    mutex_unlock(&priv->lock);
+    return retval;
+}
 
-        new_entry.buffptr = cmd_buf;
-        new_entry.size = cmd_len;
+loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+{
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_ring *ring;
+    loff_t total_size;
+    loff_t new_pos;
+    int srcu_idx;
+
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    ring = srcu_dereference(dev->ring, &dev->srcu);
+    total_size = aesd_buffer_total_size(&ring->buffer);
+    /*
+     * The new position is relative to this ring, so rebase a following
+     * reader onto it, carrying f_pos along for SEEK_CUR as aesd_read_iter() does.
+     */
+    if (priv->follow) {
+        loff_t shift = ring->base - priv->base;
+
+        filp->f_pos = filp->f_pos > shift ? filp->f_pos - shift : 0;
+        priv->base = ring->base;
+    }
+    srcu_read_unlock(&dev->srcu, srcu_idx);
 
-        /* Save the buffptr of the entry about to be evicted BEFORE add overwrites it */
-        {
-            const struct aesd_buffer_entry *evicted =
-                aesd_circular_buffer_add_entry(&dev->buffer, &new_entry);
-            if (evicted && evicted->buffptr)
-                kfree((void *)evicted->buffptr);
-        }
+    new_pos = fixed_size_llseek(filp, offset, whence, total_size);
+    return new_pos;
+}
 
-        /* Remove the consumed command from partial buffer */
-        size_t remaining = dev->partial_write_size - cmd_len;
-        if (remaining > 0) {
-            memmove(dev->partial_write_buf,
-                    dev->partial_write_buf + cmd_len,
-                    remaining);
-        }
-        dev->partial_write_size = remaining;
+static long aesd_ioctl_follow(struct aesd_file *priv, unsigned long arg)
+{
+    struct aesd_dev *dev = priv->dev;
+    uint32_t follow;
+    int srcu_idx;
+
+    if (copy_from_user(&follow, (void __user *)arg, sizeof(follow)))
+        return -EFAULT;
 
-        /* Check for another \n in the remaining data */
-        newline_pos = memchr(dev->partial_write_buf, '\n', dev->partial_write_size);
+    /* The current file position is interpreted against the current ring */
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    priv->base = srcu_dereference(dev->ring, &dev->srcu)->base;
+    srcu_read_unlock(&dev->srcu, srcu_idx);
+
+    priv->follow = follow != 0;
+    return 0;
+}
+
+/*
+ * Converts a zero referenced command index and offset within it to a file
+ * position in @buffer. Returns -EINVAL if either is out of range.
+ */
+static int aesd_seekto_pos(const struct aesd_circular_buffer *buffer,
+                           uint32_t write_cmd, uint32_t write_cmd_offset,
+                           loff_t *pos)
+{
+    loff_t abs_offset = 0;
+    uint8_t num_entries = 0;
+    uint8_t i;
+    uint8_t target_idx;
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        if (!buffer->full && idx == buffer->in_offs)
+            break;
+        if (buffer->entry[idx].buffptr == NULL)
+            break;
+        num_entries++;
     }
 
-    retval = count;
+    if (write_cmd >= num_entries)
+        return -EINVAL;
 
-out:
-    mutex_unlock(&dev->lock);
+    target_idx = (buffer->out_offs + write_cmd)
+                 % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    if (write_cmd_offset >= buffer->entry[target_idx].size)
+        return -EINVAL;
+
+    for (i = 0; i < write_cmd; i++) {
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        abs_offset += buffer->entry[idx].size;
+    }
+    *pos = abs_offset + write_cmd_offset;
+    return 0;
+}
+
+static long aesd_ioctl_seekto(struct file *filp, unsigned long arg)
+{
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_ring *ring;
+    struct aesd_seekto seekto;
+    loff_t pos;
+    long retval;
+    int srcu_idx;
+
+    if (copy_from_user(&seekto, (void __user *)arg, sizeof(seekto)))
+        return -EFAULT;
+
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    ring = srcu_dereference(dev->ring, &dev->srcu);
+
+    retval = aesd_seekto_pos(&ring->buffer, seekto.write_cmd,
+                             seekto.write_cmd_offset, &pos);
+    if (!retval) {
+        filp->f_pos = pos;
+        priv->base = ring->base;
+    }
+
+    srcu_read_unlock(&dev->srcu, srcu_idx);
     return retval;
 }
 
-loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+static long aesd_ioctl_getindex(struct aesd_file *priv, unsigned long arg)
 {
-    struct aesd_dev *dev = filp->private_data;
-    loff_t total_size = 0;
-    loff_t new_pos;
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_ring *ring;
+    struct aesd_circular_buffer *buffer;
+    struct aesd_index index;
+    uint64_t offset = 0;
     uint8_t i;
+    int srcu_idx;
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+    memset(&index, 0, sizeof(index));
+
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    ring = srcu_dereference(dev->ring, &dev->srcu);
+    buffer = &ring->buffer;
+    index.next_seq = ring->next_seq;
 
     for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
-        uint8_t idx = (dev->buffer.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        if (!dev->buffer.full && idx == dev->buffer.in_offs)
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        if (!buffer->full && idx == buffer->in_offs)
             break;
-        if (dev->buffer.entry[idx].buffptr == NULL)
+        if (buffer->entry[idx].buffptr == NULL)
             break;
-        total_size += dev->buffer.entry[idx].size;
+        index.entry[i].offset = offset;
+        index.entry[i].size = buffer->entry[idx].size;
+        index.entry[i].seq = buffer->entry[idx].seq;
+        index.entry[i].timestamp_ns = buffer->entry[idx].timestamp_ns;
+        offset += buffer->entry[idx].size;
+        index.entry_count++;
     }
+    index.total_size = offset;
 
-    mutex_unlock(&dev->lock);
+    srcu_read_unlock(&dev->srcu, srcu_idx);
 
-    new_pos = fixed_size_llseek(filp, offset, whence, total_size);
-    return new_pos;
+    if (copy_to_user((void __user *)arg, &index, sizeof(index)))
+        return -EFAULT;
+    return 0;
 }
 
-long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+/*
+ * Seeks like AESDCHAR_IOCSEEKTO and copies from there up to range.len
+ * bytes, across command boundaries, leaving the file position after the
+ * last byte copied.
+ */
+static long aesd_ioctl_readrange(struct file *filp, unsigned long arg)
 {
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_seekto seekto;
-    loff_t abs_offset = 0;
-    uint8_t num_entries = 0;
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_ring *ring;
+    struct aesd_buffer_entry *entry;
+    struct aesd_readrange range;
+    const char *data;
+    char __user *ubuf;
+    size_t entry_offset;
+    size_t bytes_to_copy;
+    uint64_t copied = 0;
+    loff_t pos;
+    long retval;
+    int srcu_idx;
+
+    if (copy_from_user(&range, (void __user *)arg, sizeof(range)))
+        return -EFAULT;
+    ubuf = u64_to_user_ptr(range.buf);
+
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    ring = srcu_dereference(dev->ring, &dev->srcu);
+
+    retval = aesd_seekto_pos(&ring->buffer, range.write_cmd,
+                             range.write_cmd_offset, &pos);
+    if (retval)
+        goto out;
+
+    while (copied < range.len) {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&ring->buffer,
+                                                                 pos,
+                                                                 &entry_offset);
+        if (entry == NULL)
+            break;
+
+        bytes_to_copy = entry->size - entry_offset;
+        if (bytes_to_copy > range.len - copied)
+            bytes_to_copy = range.len - copied;
+
+        aesd_entry_lock(priv, entry);
+        data = aesd_entry_data(priv, entry);
+        if (IS_ERR(data))
+            retval = PTR_ERR(data);
+        else if (copy_to_user(ubuf + copied, data + entry_offset, bytes_to_copy))
+            retval = -EFAULT;
+        aesd_entry_unlock(priv, entry);
+        if (retval)
+            goto out;
+        copied += bytes_to_copy;
+        pos += bytes_to_copy;
+    }
+
+    filp->f_pos = pos;
+    priv->base = ring->base;
+
+out:
+    srcu_read_unlock(&dev->srcu, srcu_idx);
+    if (retval)
+        return retval;
+
+    range.bytes_read = copied;
+    if (copy_to_user((void __user *)arg, &range, sizeof(range)))
+        return -EFAULT;
+    return 0;
+}
+
+/*
+ * Copies whole commands with a sequence number of at least since.cursor,
+ * oldest first, for as many as fit in the user buffer. Commands that were
+ * evicted before the caller got to them are counted in since.lost. If the
+ * first command does not fit, since.len is set to its size and the header
+ * is still copied back before failing with -EMSGSIZE.
+ */
+static long aesd_ioctl_readsince(struct aesd_file *priv, unsigned long arg)
+{
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_circular_buffer *buffer;
+    struct aesd_readsince since;
+    struct aesd_buffer_entry *entry;
+    const char *data;
+    char __user *ubuf;
+    uint64_t cursor;
+    uint64_t copied = 0;
+    uint32_t entries = 0;
     uint8_t i;
-    uint8_t target_idx;
+    long retval = 0;
+    int srcu_idx;
 
-    if (cmd != AESDCHAR_IOCSEEKTO)
-        return -ENOTTY;
+    if (copy_from_user(&since, (void __user *)arg, sizeof(since)))
+        return -EFAULT;
+    ubuf = u64_to_user_ptr(since.buf);
+    cursor = since.cursor;
+    since.lost = 0;
 
-    if (copy_from_user(&seekto, (void __user *)arg, sizeof(seekto)))
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    buffer = &srcu_dereference(dev->ring, &dev->srcu)->buffer;
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        if (!buffer->full && idx == buffer->in_offs)
+            break;
+        entry = &buffer->entry[idx];
+        if (entry->buffptr == NULL)
+            break;
+        if (entry->seq < cursor)
+            continue;
+
+        /* Everything between the cursor and the oldest survivor is gone */
+        if (entries == 0 && entry->seq > cursor)
+            since.lost = entry->seq - cursor;
+
+        if (entry->size > since.len - copied) {
+            if (entries == 0) {
+                /* Skip what was lost so a retry does not count it again */
+                cursor = entry->seq;
+                since.len = entry->size;
+                retval = -EMSGSIZE;
+            }
+            break;
+        }
+        aesd_entry_lock(priv, entry);
+        data = aesd_entry_data(priv, entry);
+        if (IS_ERR(data))
+            retval = PTR_ERR(data);
+        else if (copy_to_user(ubuf + copied, data, entry->size))
+            retval = -EFAULT;
+        aesd_entry_unlock(priv, entry);
+        if (retval)
+            break;
+        copied += entry->size;
+        cursor = entry->seq + 1;
+        entries++;
+    }
+
+    srcu_read_unlock(&dev->srcu, srcu_idx);
+    if (retval && retval != -EMSGSIZE)
+        return retval;
+
+    since.cursor = cursor;
+    since.bytes_read = copied;
+    since.entries_read = entries;
+    if (copy_to_user((void __user *)arg, &since, sizeof(since)))
         return -EFAULT;
+    return retval;
+}
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+static long aesd_ioctl_getusage(struct aesd_file *priv, unsigned long arg)
+{
+    struct aesd_dev *dev = priv->dev;
+    struct aesd_circular_buffer *buffer;
+    struct aesd_buffer_entry *entry;
+    struct aesd_usage usage;
+    uint8_t i;
+    int srcu_idx;
+
+    memset(&usage, 0, sizeof(usage));
+    usage.max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    usage.max_bytes = dev->max_bytes;
+
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    buffer = &srcu_dereference(dev->ring, &dev->srcu)->buffer;
 
     for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
-        uint8_t idx = (dev->buffer.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        if (!dev->buffer.full && idx == dev->buffer.in_offs)
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        if (!buffer->full && idx == buffer->in_offs)
             break;
-        if (dev->buffer.entry[idx].buffptr == NULL)
+        entry = &buffer->entry[idx];
+        if (entry->buffptr == NULL)
             break;
-        num_entries++;
+        usage.bytes_allocated += aesd_compress ? entry->stored_size
+                                               : PAGE_ALIGN(entry->stored_size);
+        usage.entry_count++;
     }
+    usage.bytes_used = buffer->total_size;
+    usage.bytes_stored = buffer->stored_size;
 
-    if (seekto.write_cmd >= num_entries) {
-        mutex_unlock(&dev->lock);
-        return -EINVAL;
+    srcu_read_unlock(&dev->srcu, srcu_idx);
+
+    if (copy_to_user((void __user *)arg, &usage, sizeof(usage)))
+        return -EFAULT;
+    return 0;
+}
+
+long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct aesd_file *priv = filp->private_data;
+
+    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC || _IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
+        return -ENOTTY;
+
+    switch (cmd) {
+    case AESDCHAR_IOCSEEKTO:
+        return aesd_ioctl_seekto(filp, arg);
+    case AESDCHAR_IOCFOLLOW:
+        return aesd_ioctl_follow(priv, arg);
+    case AESDCHAR_IOCGETINDEX:
+        return aesd_ioctl_getindex(priv, arg);
+    case AESDCHAR_IOCREADRANGE:
+        return aesd_ioctl_readrange(filp, arg);
+    case AESDCHAR_IOCREADSINCE:
+        return aesd_ioctl_readsince(priv, arg);
+    case AESDCHAR_IOCGETUSAGE:
+        return aesd_ioctl_getusage(priv, arg);
+    default:
+        return -ENOTTY;
     }
+}
 
-    target_idx = (dev->buffer.out_offs + seekto.write_cmd)
-                 % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+/*
+ * Page 0 of the mapping is the header, followed by every stored entry in
+ * read order, each starting on a page boundary. Pages are resolved against
+ * the ring table current at fault time and are refcounted by the mapping,
+ * so an evicted entry stays readable (but stale) until its PTE is zapped.
+ */
+static vm_fault_t aesd_vm_fault(struct vm_fault *vmf)
+{
+    struct aesd_dev *dev = vmf->vma->vm_private_data;
+    struct aesd_circular_buffer *buffer;
+    struct page *page = NULL;
+    pgoff_t first = 1;
+    uint8_t i;
+    int srcu_idx;
 
-    if (seekto.write_cmd_offset >= dev->buffer.entry[target_idx].size) {
-        mutex_unlock(&dev->lock);
-        return -EINVAL;
+    if (vmf->pgoff == 0) {
+        page = virt_to_page(dev->mmap_header);
+        get_page(page);
+        vmf->page = page;
+        return 0;
     }
 
-    for (i = 0; i < seekto.write_cmd; i++) {
-        uint8_t idx = (dev->buffer.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        abs_offset += dev->buffer.entry[idx].size;
+    srcu_idx = srcu_read_lock(&dev->srcu);
+    buffer = &srcu_dereference(dev->ring, &dev->srcu)->buffer;
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        pgoff_t npages;
+
+        if (!buffer->full && idx == buffer->in_offs)
+            break;
+        if (buffer->entry[idx].buffptr == NULL)
+            break;
+        npages = PAGE_ALIGN(buffer->entry[idx].size) >> PAGE_SHIFT;
+        if (vmf->pgoff < first + npages) {
+            page = virt_to_page(buffer->entry[idx].buffptr +
+                                ((vmf->pgoff - first) << PAGE_SHIFT));
+            get_page(page);
+            break;
+        }
+        first += npages;
     }
-    abs_offset += seekto.write_cmd_offset;
 
-    filp->f_pos = abs_offset;
+    srcu_read_unlock(&dev->srcu, srcu_idx);
 
-    mutex_unlock(&dev->lock);
+    if (!page)
+        return VM_FAULT_SIGBUS;
+    vmf->page = page;
+    return 0;
+}
+
+static const struct vm_operations_struct aesd_vm_ops = {
+    .fault = aesd_vm_fault,
+};
+
+__poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &dev->read_queue, wait);
+
+    if (aesd_data_available(priv, filp->f_pos))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    return mask;
+}
+
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *priv = filp->private_data;
+    struct aesd_dev *dev = priv->dev;
+
+    /* Compressed entries have no page backed plain copy to map */
+    if (aesd_compress)
+        return -EOPNOTSUPP;
+
+    /* The mapping is a read-only view, entries are only added via write() */
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_mod(vma, VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#endif
+    vma->vm_ops = &aesd_vm_ops;
+    vma->vm_private_data = dev;
     return 0;
 }
 
 struct file_operations aesd_fops = {
     .owner          = THIS_MODULE,
     .llseek         = aesd_llseek,
-    .read           = aesd_read,
-    .write          = aesd_write,
+    .read_iter      = aesd_read_iter,
+    .write_iter     = aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read    = copy_splice_read,
+#else
+    .splice_read    = generic_file_splice_read,
+#endif
     .open           = aesd_open,
     .release        = aesd_release,
     .unlocked_ioctl = aesd_ioctl,
+    .mmap           = aesd_mmap,
+    .poll           = aesd_poll,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_stats_show(struct seq_file *s, void *unused)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats total;
+    int cpu;
+
+    memset(&total, 0, sizeof(total));
+    for_each_possible_cpu(cpu) {
+        const struct aesd_stats *stats = per_cpu_ptr(dev->stats, cpu);
+
+        total.commands_written += stats->commands_written;
+        total.bytes_written += stats->bytes_written;
+        total.evictions += stats->evictions;
+        total.partial_hwm = max(total.partial_hwm, stats->partial_hwm);
+        total.read_calls += stats->read_calls;
+        total.bytes_read += stats->bytes_read;
+        total.lock_acquisitions += stats->lock_acquisitions;
+        total.lock_wait_ns += stats->lock_wait_ns;
+        total.combined += stats->combined;
+    }
+
+    seq_printf(s, "commands_written: %llu\n", total.commands_written);
+    seq_printf(s, "bytes_written: %llu\n", total.bytes_written);
+    seq_printf(s, "evictions: %llu\n", total.evictions);
+    seq_printf(s, "partial_hwm: %llu\n", total.partial_hwm);
+    seq_printf(s, "read_calls: %llu\n", total.read_calls);
+    seq_printf(s, "bytes_read: %llu\n", total.bytes_read);
+    seq_printf(s, "lock_acquisitions: %llu\n", total.lock_acquisitions);
+    seq_printf(s, "lock_wait_ns: %llu\n", total.lock_wait_ns);
+    seq_printf(s, "combined: %llu\n", total.combined);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+static int aesd_setup_cdev(struct aesd_dev *dev, int index)
+{
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add(&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %d", err, index);
     }
     return err;
 }
 
-int aesd_init_module(void)
+/*
+ * Spreads devices round-robin over the online NUMA nodes so independent
+ * producers sharded across minors also spread their memory traffic.
+ */
+static int aesd_dev_node(int index)
 {
-    dev_t dev = 0;
-    int result;
+    int nid = first_online_node;
+    int i;
 
-    result = alloc_chrdev_region(&dev, aesd_minor, 1, "aesdchar");
-    aesd_major = MAJOR(dev);
-    if (result < 0) {
-        printk(KERN_WARNING "Can't get major %d\n", aesd_major);
-        return result;
-    }
+    for (i = 0; i < index % num_online_nodes(); i++)
+        nid = next_online_node(nid);
+    return nid;
+}
 
-    memset(&aesd_device, 0, sizeof(struct aesd_dev));
+/*
+ * Allocates and registers the device for minor aesd_minor + @index.
+ */
+static struct aesd_dev *aesd_dev_create(int index)
+{
+    struct aesd_dev *dev;
+    struct aesd_ring *ring;
+    struct page *header_page;
+    struct dentry *dir;
+    char name[sizeof("aesdchar-2147483648")];
+    int nid = aesd_dev_node(index);
+    int result;
 
-    /* Initialize mutex and circular buffer */
-    mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buffer);
-    aesd_device.partial_write_buf = NULL;
-    aesd_device.partial_write_size = 0;
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, nid);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+    dev->node = nid;
+    dev->max_bytes = aesd_max_bytes;
 
-    result = aesd_setup_cdev(&aesd_device);
-    if (result) {
-        unregister_chrdev_region(dev, 1);
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (!dev->stats) {
+        result = -ENOMEM;
+        goto fail_stats;
     }
 
-    return result;
+    /* Initialize locks and an empty ring table */
+    ring = kzalloc_node(sizeof(*ring), GFP_KERNEL, nid);
+    if (!ring) {
+        result = -ENOMEM;
+        goto fail_ring;
+    }
+    aesd_circular_buffer_init(&ring->buffer);
+    RCU_INIT_POINTER(dev->ring, ring);
+
+    header_page = alloc_pages_node(nid, GFP_KERNEL | __GFP_ZERO, 0);
+    if (!header_page) {
+        result = -ENOMEM;
+        goto fail_header;
+    }
+    dev->mmap_header = page_address(header_page);
+
+    mutex_init(&dev->lock);
+    init_waitqueue_head(&dev->read_queue);
+    init_llist_head(&dev->commit_queue);
+    init_waitqueue_head(&dev->combine_wait);
+    result = init_srcu_struct(&dev->srcu);
+    if (result)
+        goto fail_srcu;
+    dev->partial_write_buf = NULL;
+    dev->partial_write_size = 0;
+
+    result = aesd_setup_cdev(dev, index);
+    if (result)
+        goto fail_cdev;
+
+    /* debugfs is best effort, the device works without it */
+    snprintf(name, sizeof(name), "aesdchar%d", index);
+    dir = debugfs_create_dir(name, aesd_debugfs_root);
+    debugfs_create_file("stats", 0444, dir, dev, &aesd_stats_fops);
+
+    return dev;
+
+fail_cdev:
+    cleanup_srcu_struct(&dev->srcu);
+fail_srcu:
+    mutex_destroy(&dev->lock);
+    free_page((unsigned long)dev->mmap_header);
+fail_header:
+    kfree(ring);
+fail_ring:
+    free_percpu(dev->stats);
+fail_stats:
+    kfree(dev);
+    return ERR_PTR(result);
 }
 
-void aesd_cleanup_module(void)
+static void aesd_dev_destroy(struct aesd_dev *dev)
 {
-    dev_t devno = MKDEV(aesd_major, aesd_minor);
     uint8_t index;
     struct aesd_buffer_entry *entry;
+    struct aesd_ring *ring;
+
+    cdev_del(&dev->cdev);
 
-    cdev_del(&aesd_device.cdev);
+    /* Let pending ring reclaims run before tearing down the live table */
+    srcu_barrier(&dev->srcu);
+    ring = rcu_dereference_protected(dev->ring, 1);
 
     /* Free all circular buffer entries */
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, index) {
-        if (entry->buffptr) {
-            kfree((void *)entry->buffptr);
-            entry->buffptr = NULL;
-        }
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring->buffer, index) {
+        aesd_entry_free(entry);
+        entry->buffptr = NULL;
     }
+    kfree(ring);
+    free_page((unsigned long)dev->mmap_header);
 
     /* Free any partial write buffer */
-    if (aesd_device.partial_write_buf) {
-        kfree(aesd_device.partial_write_buf);
-        aesd_device.partial_write_buf = NULL;
+    if (dev->partial_write_buf) {
+        kfree(dev->partial_write_buf);
+        dev->partial_write_buf = NULL;
+    }
+
+    cleanup_srcu_struct(&dev->srcu);
+    mutex_destroy(&dev->lock);
+    free_percpu(dev->stats);
+    kfree(dev);
+}
+
+void aesd_cleanup_module(void)
+{
+    dev_t devno = MKDEV(aesd_major, aesd_minor);
+    int i;
+
+    /* No stats file may outlive the device it points at */
+    debugfs_remove_recursive(aesd_debugfs_root);
+
+    for (i = 0; i < aesd_nr_devs; i++) {
+        if (aesd_devices[i])
+            aesd_dev_destroy(aesd_devices[i]);
     }
+    kfree(aesd_devices);
 
-    mutex_destroy(&aesd_device.lock);
+    unregister_chrdev_region(devno, aesd_nr_devs);
+}
 
-    unregister_chrdev_region(devno, 1);
+int aesd_init_module(void)
+{
+    dev_t dev = 0;
+    int result;
+    int i;
+
+    BUILD_BUG_ON(AESDCHAR_MAX_ENTRIES != AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    BUILD_BUG_ON(sizeof(struct aesd_mmap_header) > PAGE_SIZE);
+
+    if (aesd_nr_devs < 1)
+        return -EINVAL;
+
+    result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs, "aesdchar");
+    aesd_major = MAJOR(dev);
+    if (result < 0) {
+        printk(KERN_WARNING "Can't get major %d\n", aesd_major);
+        return result;
+    }
+
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(*aesd_devices), GFP_KERNEL);
+    if (!aesd_devices) {
+        unregister_chrdev_region(dev, aesd_nr_devs);
+        return -ENOMEM;
+    }
+
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
+
+    for (i = 0; i < aesd_nr_devs; i++) {
+        struct aesd_dev *aesd_dev = aesd_dev_create(i);
+
+        if (IS_ERR(aesd_dev)) {
+            result = PTR_ERR(aesd_dev);
+            aesd_cleanup_module();
+            return result;
+        }
+        aesd_devices[i] = aesd_dev;
+    }
+
+    return 0;
 }
 
 module_init(aesd_init_module);
-module_exit(aesd_cleanup_module);
\ No newline at end of file
+module_exit(aesd_cleanup_module);
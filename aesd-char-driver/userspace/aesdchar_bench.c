@@ -0,0 +1,387 @@
+/*
+ * aesdchar_bench.c
+ *
+ *  @brief Microbenchmarks for the aesdchar driver running in userspace
+ *  through the kshim. Each workload loads a fresh driver instance, so one
+ *  can be run in isolation under perf record or valgrind --tool=callgrind:
+ *
+ *      aesdchar-bench -b write -n 1000000
+ *      valgrind --tool=callgrind aesdchar-bench -b seek -n 10000
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../aesd_ioctl.h"
+#include "aesdchar_shim.h"
+
+struct bench_config
+{
+    long iterations;
+    int threads;
+    size_t size;
+    bool compress;
+    bool stats;
+};
+
+struct bench
+{
+    const char *name;
+    const char *description;
+    /* Returns the number of operations done or -1 after printing an error */
+    long (*run)(const struct bench_config *cfg, size_t *bytes);
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Fills @buf with @size bytes of printable text ending in a newline, so
+ * each buffer is one complete command
+ */
+static void fill_command(char *buf, size_t size, unsigned int seed)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < size; i++)
+        buf[i] = 'a' + (seed + i) % 26;
+    buf[size - 1] = '\n';
+}
+
+static bool check_write(ssize_t ret, size_t expected)
+{
+    if (ret == (ssize_t)expected)
+        return true;
+    fprintf(stderr, "write returned %zd, expected %zu\n", ret, expected);
+    return false;
+}
+
+/* Fills the device with a full ring of @size byte commands */
+static bool prefill(struct aesdchar_shim_file *file, size_t size)
+{
+    char *cmd = malloc(size);
+    bool ok = cmd != NULL;
+    int i;
+
+    for (i = 0; ok && i < AESDCHAR_MAX_ENTRIES; i++) {
+        fill_command(cmd, size, i);
+        ok = check_write(aesdchar_shim_write(file, cmd, size), size);
+    }
+    free(cmd);
+    return ok;
+}
+
+/* One complete command per write, every write evicts once the ring is full */
+static long bench_write(const struct bench_config *cfg, size_t *bytes)
+{
+    struct aesdchar_shim_file *file = aesdchar_shim_open(0);
+    char *cmd = malloc(cfg->size);
+    long i;
+
+    if (!file || !cmd)
+        return -1;
+    fill_command(cmd, cfg->size, 0);
+    for (i = 0; i < cfg->iterations; i++) {
+        if (!check_write(aesdchar_shim_write(file, cmd, cfg->size), cfg->size))
+            break;
+    }
+    *bytes = i * cfg->size;
+    free(cmd);
+    aesdchar_shim_close(file);
+    return i;
+}
+
+/*
+ * Many newline separated commands per write, exercising the single pass
+ * split and the batched ring publication. Counts commands, not writes.
+ */
+static long bench_batch(const struct bench_config *cfg, size_t *bytes)
+{
+    const int per_write = 64;
+    struct aesdchar_shim_file *file = aesdchar_shim_open(0);
+    size_t len = cfg->size * per_write;
+    char *buf = malloc(len);
+    long done = 0;
+    int i;
+
+    if (!file || !buf)
+        return -1;
+    for (i = 0; i < per_write; i++)
+        fill_command(buf + i * cfg->size, cfg->size, i);
+    while (done < cfg->iterations) {
+        if (!check_write(aesdchar_shim_write(file, buf, len), len))
+            break;
+        done += per_write;
+    }
+    *bytes = done * cfg->size;
+    free(buf);
+    aesdchar_shim_close(file);
+    return done;
+}
+
+struct writer_arg
+{
+    const struct bench_config *cfg;
+    long done;
+};
+
+static void *writer_thread(void *data)
+{
+    struct writer_arg *arg = data;
+    struct aesdchar_shim_file *file = aesdchar_shim_open(0);
+    char *cmd = malloc(arg->cfg->size);
+    long i;
+
+    if (!file || !cmd)
+        goto out;
+    fill_command(cmd, arg->cfg->size, 0);
+    for (i = 0; i < arg->cfg->iterations / arg->cfg->threads; i++) {
+        if (!check_write(aesdchar_shim_write(file, cmd, arg->cfg->size), arg->cfg->size))
+            break;
+    }
+    arg->done = i;
+out:
+    free(cmd);
+    if (file)
+        aesdchar_shim_close(file);
+    return NULL;
+}
+
+/* Several threads writing through their own open files, contending on commit */
+static long bench_concurrent(const struct bench_config *cfg, size_t *bytes)
+{
+    pthread_t *threads = calloc(cfg->threads, sizeof(*threads));
+    struct writer_arg *args = calloc(cfg->threads, sizeof(*args));
+    long done = 0;
+    int i;
+
+    if (!threads || !args) {
+        free(threads);
+        free(args);
+        return -1;
+    }
+    for (i = 0; i < cfg->threads; i++) {
+        args[i].cfg = cfg;
+        pthread_create(&threads[i], NULL, writer_thread, &args[i]);
+    }
+    for (i = 0; i < cfg->threads; i++) {
+        pthread_join(threads[i], NULL);
+        done += args[i].done;
+    }
+    *bytes = done * cfg->size;
+    free(threads);
+    free(args);
+    return done;
+}
+
+/* Reads the whole device start to end in @size byte chunks */
+static long bench_read(const struct bench_config *cfg, size_t *bytes)
+{
+    struct aesdchar_shim_file *file = aesdchar_shim_open(0);
+    char *buf = malloc(cfg->size);
+    long i;
+
+    *bytes = 0;
+    if (!file || !buf || !prefill(file, cfg->size))
+        return -1;
+    for (i = 0; i < cfg->iterations; i++) {
+        ssize_t ret;
+
+        aesdchar_shim_llseek(file, 0, SEEK_SET);
+        while ((ret = aesdchar_shim_read(file, buf, cfg->size)) > 0)
+            *bytes += ret;
+        if (ret < 0) {
+            fprintf(stderr, "read returned %zd\n", ret);
+            break;
+        }
+    }
+    free(buf);
+    aesdchar_shim_close(file);
+    return i;
+}
+
+/* AESDCHAR_IOCSEEKTO to a pseudo-random command and offset, then a short read */
+static long bench_seek(const struct bench_config *cfg, size_t *bytes)
+{
+    struct aesdchar_shim_file *file = aesdchar_shim_open(0);
+    unsigned int seed = 1;
+    char buf[16];
+    long i;
+
+    *bytes = 0;
+    if (!file || !prefill(file, cfg->size))
+        return -1;
+    for (i = 0; i < cfg->iterations; i++) {
+        struct aesd_seekto seekto;
+        ssize_t ret;
+        long err;
+
+        seed = seed * 1103515245 + 12345;
+        seekto.write_cmd = (seed >> 16) % AESDCHAR_MAX_ENTRIES;
+        seekto.write_cmd_offset = (seed >> 8) % cfg->size;
+        err = aesdchar_shim_ioctl(file, AESDCHAR_IOCSEEKTO, &seekto);
+        if (err) {
+            fprintf(stderr, "AESDCHAR_IOCSEEKTO returned %ld\n", err);
+            break;
+        }
+        ret = aesdchar_shim_read(file, buf, sizeof(buf));
+        if (ret < 0)
+            break;
+        *bytes += ret;
+    }
+    aesdchar_shim_close(file);
+    return i;
+}
+
+/*
+ * Writes commands of varying size under a byte budget of four average
+ * commands, so most writes evict several entries
+ */
+static long bench_evict(const struct bench_config *cfg, size_t *bytes)
+{
+    struct aesdchar_shim_file *file = aesdchar_shim_open(0);
+    size_t max_size = cfg->size * 2;
+    char *cmd = malloc(max_size);
+    long i;
+
+    *bytes = 0;
+    if (!file || !cmd)
+        return -1;
+    for (i = 0; i < cfg->iterations; i++) {
+        size_t size = 1 + (i * 7919) % max_size;
+
+        fill_command(cmd, size, i);
+        if (!check_write(aesdchar_shim_write(file, cmd, size), size))
+            break;
+        *bytes += size;
+    }
+    free(cmd);
+    aesdchar_shim_close(file);
+    return i;
+}
+
+static const struct bench benches[] = {
+    { "write", "single command writes", bench_write },
+    { "batch", "64 commands per write", bench_batch },
+    { "concurrent", "single command writes from -t threads", bench_concurrent },
+    { "read", "sequential reads of a full ring", bench_read },
+    { "seek", "AESDCHAR_IOCSEEKTO plus a 16 byte read", bench_seek },
+    { "evict", "mixed size writes under a byte budget", bench_evict },
+};
+
+static int run_bench(const struct bench *bench, const struct bench_config *cfg)
+{
+    /* Only the eviction workload runs with a byte budget */
+    unsigned long max_bytes = bench->run == bench_evict ? cfg->size * 4 : 0;
+    uint64_t start, elapsed;
+    size_t bytes = 0;
+    long ops;
+    int err;
+
+    err = aesdchar_shim_init(1, max_bytes, cfg->compress);
+    if (err) {
+        fprintf(stderr, "%s: driver init failed: %s\n", bench->name, strerror(-err));
+        return -1;
+    }
+    start = now_ns();
+    ops = bench->run(cfg, &bytes);
+    elapsed = now_ns() - start;
+    if (ops > 0) {
+        printf("%-12s %10ld ops %10.1f ns/op %10.1f MB/s\n", bench->name, ops,
+               (double)elapsed / ops, elapsed ? bytes * 1e3 / elapsed : 0.0);
+    }
+    if (cfg->stats)
+        aesdchar_shim_print_stats(0);
+    aesdchar_shim_exit();
+    return ops > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+    size_t i;
+
+    fprintf(stderr,
+            "Usage: %s [-b bench[,bench...]] [-n iterations] [-t threads] [-s size] [-z] [-v]\n"
+            "  -z  store commands LZ4 compressed\n"
+            "  -v  print the driver statistics after each benchmark\n"
+            "Benchmarks, all by default:\n", prog);
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        fprintf(stderr, "  %-12s %s\n", benches[i].name, benches[i].description);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_config cfg = {
+        .iterations = 100000,
+        .threads = 4,
+        .size = 64,
+    };
+    const char *selected = NULL;
+    int status = 0;
+    int ran = 0;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:t:s:zvh")) != -1) {
+        switch (opt) {
+        case 'b':
+            selected = optarg;
+            break;
+        case 'n':
+            cfg.iterations = strtol(optarg, NULL, 0);
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 's':
+            cfg.size = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            cfg.compress = true;
+            break;
+        case 'v':
+            cfg.stats = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cfg.iterations < 1 || cfg.threads < 1 || cfg.size < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (selected) {
+            size_t len = strlen(benches[i].name);
+            const char *match = strstr(selected, benches[i].name);
+
+            /* Accept whole entries of the comma separated list only */
+            while (match && ((match != selected && match[-1] != ',') ||
+                             (match[len] != '\0' && match[len] != ',')))
+                match = strstr(match + 1, benches[i].name);
+            if (!match)
+                continue;
+        }
+        if (run_bench(&benches[i], &cfg))
+            status = 1;
+        ran++;
+    }
+    if (!ran) {
+        usage(argv[0]);
+        return 1;
+    }
+    return status;
+}
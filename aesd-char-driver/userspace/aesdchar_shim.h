@@ -0,0 +1,42 @@
+/*
+ * aesdchar_shim.h
+ *
+ *  @brief File-like interface to the aesdchar driver built as a userspace
+ *  library. Calls go straight to the driver's file_operations, so a
+ *  benchmark or test sees the same code paths as read(2) and write(2) on
+ *  /dev/aesdchar. Return values follow the driver: negative errno on error.
+ */
+
+#ifndef AESDCHAR_SHIM_H
+#define AESDCHAR_SHIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct aesdchar_shim_file;
+
+/**
+ * Load the driver with the given module parameters. @max_bytes of 0 leaves
+ * only the entry count limit, @compress selects LZ4 storage.
+ */
+int aesdchar_shim_init(int nr_devs, unsigned long max_bytes, bool compress);
+void aesdchar_shim_exit(void);
+
+/**
+ * Open minor @minor, returns NULL if it does not exist or on allocation failure
+ */
+struct aesdchar_shim_file *aesdchar_shim_open(int minor);
+void aesdchar_shim_close(struct aesdchar_shim_file *file);
+
+ssize_t aesdchar_shim_write(struct aesdchar_shim_file *file, const void *buf, size_t count);
+ssize_t aesdchar_shim_read(struct aesdchar_shim_file *file, void *buf, size_t count);
+long long aesdchar_shim_llseek(struct aesdchar_shim_file *file, long long offset, int whence);
+long aesdchar_shim_ioctl(struct aesdchar_shim_file *file, unsigned int cmd, void *arg);
+
+/**
+ * Print the per-device counters normally found in debugfs to stdout
+ */
+void aesdchar_shim_print_stats(int minor);
+
+#endif /* AESDCHAR_SHIM_H */
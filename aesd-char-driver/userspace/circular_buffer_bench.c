@@ -0,0 +1,170 @@
+/*
+ * circular_buffer_bench.c
+ *
+ *  @brief Offset lookup cost of the array-of-structs circular buffer layout
+ *  against aesd-circular-buffer-soa at ring sizes from 10 to 64k entries.
+ *
+ *  The array-of-structs side reproduces aesd_circular_buffer_find_entry_offset_for_fpos()
+ *  (modulo indexing, full flag and NULL checks over struct aesd_buffer_entry)
+ *  with a runtime capacity, since the real buffer is fixed at
+ *  AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries. Both layouts must find
+ *  the same slot and offset.
+ *
+ *  Usage: circular-buffer-bench [scanned entries per ring size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../aesd-circular-buffer-soa.h"
+
+struct aos_buffer
+{
+    struct aesd_buffer_entry *entry;
+    size_t capacity;
+    size_t in_offs;
+    size_t out_offs;
+    bool full;
+};
+
+static struct aesd_buffer_entry *aos_find_entry_offset_for_fpos(struct aos_buffer *buffer,
+    size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    size_t cumulative = 0;
+    size_t i, index;
+
+    for (i = 0; i < buffer->capacity; i++) {
+        index = (buffer->out_offs + i) % buffer->capacity;
+        if (!buffer->full && index == buffer->in_offs)
+            break;
+        if (buffer->entry[index].buffptr == NULL)
+            break;
+        if (char_offset < cumulative + buffer->entry[index].size) {
+            *entry_offset_byte_rtn = char_offset - cumulative;
+            return &buffer->entry[index];
+        }
+        cumulative += buffer->entry[index].size;
+    }
+    return NULL;
+}
+
+static void aos_add_entry(struct aos_buffer *buffer, const struct aesd_buffer_entry *add)
+{
+    if (buffer->full)
+        buffer->out_offs = (buffer->out_offs + 1) % buffer->capacity;
+    buffer->entry[buffer->in_offs] = *add;
+    buffer->in_offs = (buffer->in_offs + 1) % buffer->capacity;
+    if (buffer->in_offs == buffer->out_offs)
+        buffer->full = true;
+}
+
+static double elapsed_ns(const struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static int bench_capacity(size_t capacity, size_t scan_budget)
+{
+    static const char data[] = "x";
+    struct aos_buffer aos = { 0 };
+    struct aesd_soa_circular_buffer soa;
+    size_t *sizes = aligned_alloc(AESD_SOA_CACHELINE_SIZE,
+                                  (capacity * sizeof(size_t) + AESD_SOA_CACHELINE_SIZE - 1) &
+                                  ~(size_t)(AESD_SOA_CACHELINE_SIZE - 1));
+    const char **buffptrs = calloc(capacity, sizeof(*buffptrs));
+    size_t *offsets;
+    size_t lookups = scan_budget / capacity;
+    size_t i, total = 0, found = 0;
+    double aos_ns, soa_ns;
+    struct timespec start;
+    int status = 0;
+
+    if (lookups < 1000)
+        lookups = 1000;
+    offsets = malloc(lookups * sizeof(*offsets));
+    aos.entry = calloc(capacity, sizeof(*aos.entry));
+    aos.capacity = capacity;
+    if (!sizes || !buffptrs || !offsets || !aos.entry) {
+        fprintf(stderr, "out of memory at capacity %zu\n", capacity);
+        status = 1;
+        goto out;
+    }
+    aesd_soa_circular_buffer_init(&soa, sizes, buffptrs, capacity);
+
+    /* Wrap the ring once so both layouts scan across the array end */
+    for (i = 0; i < capacity + capacity / 3; i++) {
+        struct aesd_buffer_entry entry = { .buffptr = data, .size = 1 + (i * 37) % 200 };
+
+        aos_add_entry(&aos, &entry);
+        aesd_soa_circular_buffer_add_entry(&soa, &entry, NULL);
+    }
+    srand(1);
+    for (i = 0; i < lookups; i++)
+        offsets[i] = ((size_t)rand() * RAND_MAX + rand()) % soa.total_size;
+
+    for (i = 0; i < lookups && i < 1000; i++) {
+        size_t aos_offset, soa_offset;
+        struct aesd_buffer_entry *entry = aos_find_entry_offset_for_fpos(&aos, offsets[i],
+                                                                         &aos_offset);
+        size_t slot = aesd_soa_circular_buffer_find_entry_offset_for_fpos(&soa, offsets[i],
+                                                                          &soa_offset);
+
+        if (entry == NULL || slot != (size_t)(entry - aos.entry) || aos_offset != soa_offset) {
+            fprintf(stderr, "layouts disagree at capacity %zu offset %zu\n",
+                    capacity, offsets[i]);
+            status = 1;
+            goto out;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < lookups; i++) {
+        size_t offset;
+
+        if (aos_find_entry_offset_for_fpos(&aos, offsets[i], &offset))
+            total += offset;
+    }
+    aos_ns = elapsed_ns(&start) / lookups;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < lookups; i++) {
+        size_t offset;
+
+        if (aesd_soa_circular_buffer_find_entry_offset_for_fpos(&soa, offsets[i], &offset) !=
+            AESD_SOA_NO_ENTRY)
+            found += offset;
+    }
+    soa_ns = elapsed_ns(&start) / lookups;
+
+    /* Keeps both timed loops from being optimised away */
+    if (total != found) {
+        fprintf(stderr, "layouts disagree at capacity %zu\n", capacity);
+        status = 1;
+        goto out;
+    }
+    printf("%8zu %10zu %14.1f %14.1f %8.2fx\n", capacity, lookups, aos_ns, soa_ns,
+           aos_ns / soa_ns);
+out:
+    free(aos.entry);
+    free(offsets);
+    free(buffptrs);
+    free(sizes);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t capacities[] = { 10, 100, 1000, 10000, 65536 };
+    size_t scan_budget = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000000;
+    int status = 0;
+    size_t i;
+
+    printf("%8s %10s %14s %14s %9s\n", "entries", "lookups", "aos ns/lookup",
+           "soa ns/lookup", "speedup");
+    for (i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++)
+        status |= bench_capacity(capacities[i], scan_budget);
+    return status;
+}
@@ -0,0 +1,653 @@
+/*
+ * kshim.h
+ *
+ *  @brief Minimal userspace stand-ins for the kernel APIs used by main.c
+ *
+ *  Lets the aesdchar driver be compiled and run as an ordinary process so
+ *  it can be profiled with perf, valgrind or the sanitizers. Every
+ *  <linux/...> header the driver includes is generated by CMake as a stub
+ *  that pulls in this file, see CMakeLists.txt.
+ *
+ *  Only the behaviour the driver depends on is modelled: allocations map to
+ *  libc, mutexes and wait queues to pthreads, SRCU to a rwlock with
+ *  deferred callbacks, and per-CPU data to a single shared copy. User
+ *  pointers are plain pointers, so copy_{to,from}_user never fault.
+ */
+
+#ifndef AESD_KSHIM_H
+#define AESD_KSHIM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define __KERNEL__ 1
+#define __user
+#define __rcu
+#define __percpu
+
+/* Types */
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef unsigned long pgoff_t;
+typedef unsigned int vm_fault_t;
+typedef unsigned int __poll_t;
+#define loff_t long long
+#define dev_t unsigned int
+
+/* Logging and module boilerplate */
+#define KERN_DEBUG ""
+#define KERN_INFO ""
+#define KERN_WARNING ""
+#define KERN_ERR ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_PARM_DESC(name, desc)
+#define module_param(name, type, perm)
+#define module_init(fn) int aesd_shim_module_init(void) { return fn(); }
+#define module_exit(fn) void aesd_shim_module_exit(void) { fn(); }
+#define THIS_MODULE NULL
+#define S_IRUGO 0444
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 6, 0)
+
+/* Errors */
+#define ERESTARTSYS 512
+#define ERR_PTR(err) ((void *)(long)(err))
+#define PTR_ERR(ptr) ((long)(ptr))
+#define IS_ERR(ptr) ((unsigned long)(ptr) >= (unsigned long)-4095)
+
+/* Helpers */
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define BUILD_BUG_ON(cond) _Static_assert(!(cond), #cond)
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+
+/* Memory ordering */
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+/* Allocation */
+#define GFP_KERNEL 0
+#define __GFP_ZERO 0x100
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+struct page;
+
+static inline void *kmalloc(size_t size, int flags)
+{
+    (void)flags;
+    return malloc(size ? size : 1);
+}
+
+static inline void *kzalloc(size_t size, int flags)
+{
+    (void)flags;
+    return calloc(1, size ? size : 1);
+}
+
+static inline void *kcalloc(size_t n, size_t size, int flags)
+{
+    (void)flags;
+    return calloc(n ? n : 1, size);
+}
+
+static inline void *krealloc(const void *ptr, size_t size, int flags)
+{
+    (void)flags;
+    return realloc((void *)ptr, size ? size : 1);
+}
+
+static inline void kfree(const void *ptr)
+{
+    free((void *)ptr);
+}
+
+#define kmalloc_node(size, flags, nid) kmalloc(size, flags)
+#define kzalloc_node(size, flags, nid) kzalloc(size, flags)
+#define kvmalloc(size, flags) kmalloc(size, flags)
+#define kvmalloc_node(size, flags, nid) kmalloc(size, flags)
+#define kvmalloc_array(n, size, flags) kcalloc(n, size, flags)
+#define kvfree(ptr) kfree(ptr)
+
+static inline void *alloc_pages_exact(size_t size, int flags)
+{
+    void *ptr = NULL;
+
+    if (posix_memalign(&ptr, PAGE_SIZE, size ? size : 1))
+        return NULL;
+    if (flags & __GFP_ZERO)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+static inline void free_pages_exact(void *ptr, size_t size)
+{
+    (void)size;
+    free(ptr);
+}
+
+#define alloc_pages_exact_nid(nid, size, flags) alloc_pages_exact(size, flags)
+#define alloc_pages_node(nid, flags, order) \
+    ((struct page *)alloc_pages_exact(PAGE_SIZE << (order), flags))
+#define page_address(page) ((void *)(page))
+#define virt_to_page(addr) ((struct page *)(addr))
+#define get_page(page) ((void)(page))
+#define free_page(addr) free((void *)(addr))
+
+/* NUMA, a single node */
+#define first_online_node 0
+#define next_online_node(nid) ((nid) + 1)
+#define num_online_nodes() 1
+
+/* Per-CPU data, one copy shared by every thread */
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) ((void)(cpu), (ptr))
+#define get_cpu_ptr(ptr) (ptr)
+#define put_cpu_ptr(ptr) ((void)(ptr))
+#define this_cpu_inc(var) __atomic_fetch_add(&(var), 1, __ATOMIC_RELAXED)
+#define this_cpu_add(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+/* Time */
+static inline u64 shim_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#define ktime_get_ns() shim_clock_ns(CLOCK_MONOTONIC)
+#define ktime_get_real_ns() shim_clock_ns(CLOCK_REALTIME)
+
+/* User copies */
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* Mutexes */
+struct mutex
+{
+    pthread_mutex_t m;
+};
+
+#define mutex_init(lock) pthread_mutex_init(&(lock)->m, NULL)
+#define mutex_destroy(lock) pthread_mutex_destroy(&(lock)->m)
+#define mutex_lock(lock) pthread_mutex_lock(&(lock)->m)
+#define mutex_lock_interruptible(lock) pthread_mutex_lock(&(lock)->m)
+#define mutex_trylock(lock) (pthread_mutex_trylock(&(lock)->m) == 0)
+#define mutex_unlock(lock) pthread_mutex_unlock(&(lock)->m)
+#define lockdep_is_held(lock) 1
+#define lockdep_assert_held(lock) do { } while (0)
+
+static inline bool mutex_is_locked(struct mutex *lock)
+{
+    if (pthread_mutex_trylock(&lock->m))
+        return true;
+    pthread_mutex_unlock(&lock->m);
+    return false;
+}
+
+/*
+ * SRCU: readers hold a rwlock for reading. call_srcu() queues the callback
+ * and runs everything queued as soon as it finds no reader inside.
+ */
+struct rcu_head
+{
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+struct srcu_struct
+{
+    pthread_rwlock_t readers;
+    pthread_mutex_t pending_lock;
+    struct rcu_head *pending;
+};
+
+static inline int init_srcu_struct(struct srcu_struct *s)
+{
+    pthread_rwlock_init(&s->readers, NULL);
+    pthread_mutex_init(&s->pending_lock, NULL);
+    s->pending = NULL;
+    return 0;
+}
+
+static inline int srcu_read_lock(struct srcu_struct *s)
+{
+    pthread_rwlock_rdlock(&s->readers);
+    return 0;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *s, int idx)
+{
+    (void)idx;
+    pthread_rwlock_unlock(&s->readers);
+}
+
+static inline void shim_srcu_run_pending(struct srcu_struct *s)
+{
+    struct rcu_head *head;
+
+    pthread_mutex_lock(&s->pending_lock);
+    head = s->pending;
+    s->pending = NULL;
+    pthread_mutex_unlock(&s->pending_lock);
+
+    while (head) {
+        struct rcu_head *next = head->next;
+
+        head->func(head);
+        head = next;
+    }
+}
+
+static inline void call_srcu(struct srcu_struct *s, struct rcu_head *head,
+                             void (*func)(struct rcu_head *head))
+{
+    head->func = func;
+    pthread_mutex_lock(&s->pending_lock);
+    head->next = s->pending;
+    s->pending = head;
+    pthread_mutex_unlock(&s->pending_lock);
+
+    if (pthread_rwlock_trywrlock(&s->readers) == 0) {
+        pthread_rwlock_unlock(&s->readers);
+        shim_srcu_run_pending(s);
+    }
+}
+
+static inline void srcu_barrier(struct srcu_struct *s)
+{
+    pthread_rwlock_wrlock(&s->readers);
+    pthread_rwlock_unlock(&s->readers);
+    shim_srcu_run_pending(s);
+}
+
+#define cleanup_srcu_struct(s) srcu_barrier(s)
+#define srcu_dereference(p, s) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, cond) (p)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+
+/* Lock-free lists */
+struct llist_node
+{
+    struct llist_node *next;
+};
+
+struct llist_head
+{
+    struct llist_node *first;
+};
+
+#define init_llist_head(head) ((head)->first = NULL)
+
+static inline bool llist_add(struct llist_node *node, struct llist_head *head)
+{
+    struct llist_node *first = __atomic_load_n(&head->first, __ATOMIC_RELAXED);
+
+    do {
+        node->next = first;
+    } while (!__atomic_compare_exchange_n(&head->first, &first, node, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return first == NULL;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head)
+{
+    return __atomic_exchange_n(&head->first, NULL, __ATOMIC_ACQUIRE);
+}
+
+static inline struct llist_node *llist_reverse_order(struct llist_node *head)
+{
+    struct llist_node *reversed = NULL;
+
+    while (head) {
+        struct llist_node *node = head;
+
+        head = head->next;
+        node->next = reversed;
+        reversed = node;
+    }
+    return reversed;
+}
+
+#define llist_entry(ptr, type, member) container_of(ptr, type, member)
+#define member_address_is_nonnull(ptr, member) \
+    ((uintptr_t)(ptr) + offsetof(typeof(*(ptr)), member) != 0)
+#define llist_for_each_entry(pos, node, member) \
+    for ((pos) = llist_entry((node), typeof(*(pos)), member); \
+         member_address_is_nonnull(pos, member); \
+         (pos) = llist_entry((pos)->member.next, typeof(*(pos)), member))
+#define llist_for_each_entry_safe(pos, n, node, member) \
+    for ((pos) = llist_entry((node), typeof(*(pos)), member); \
+         member_address_is_nonnull(pos, member) && \
+         ((n) = llist_entry((pos)->member.next, typeof(*(n)), member), true); \
+         (pos) = (n))
+
+/*
+ * Wait queues: a condition variable, with waits bounded to a millisecond
+ * so a wakeup racing with the condition check is never lost for long.
+ */
+typedef struct
+{
+    pthread_mutex_t m;
+    pthread_cond_t c;
+} wait_queue_head_t;
+
+typedef struct
+{
+    int unused;
+} poll_table;
+
+static inline void init_waitqueue_head(wait_queue_head_t *q)
+{
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->c, NULL);
+}
+
+static inline void wake_up_all(wait_queue_head_t *q)
+{
+    pthread_mutex_lock(&q->m);
+    pthread_cond_broadcast(&q->c);
+    pthread_mutex_unlock(&q->m);
+}
+
+static inline void shim_wait_queue_sleep(wait_queue_head_t *q)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&q->m);
+    pthread_cond_timedwait(&q->c, &q->m, &ts);
+    pthread_mutex_unlock(&q->m);
+}
+
+#define wake_up(q) wake_up_all(q)
+#define wake_up_interruptible(q) wake_up_all(q)
+#define wait_event(q, cond) \
+    do { while (!(cond)) shim_wait_queue_sleep(&(q)); } while (0)
+#define wait_event_interruptible(q, cond) \
+    ({ while (!(cond)) shim_wait_queue_sleep(&(q)); 0; })
+#define poll_wait(filp, q, pt) do { (void)(filp); (void)(q); (void)(pt); } while (0)
+#define EPOLLIN POLLIN
+#define EPOLLOUT POLLOUT
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLWRNORM POLLWRNORM
+
+/* iov_iter over an array of iovecs */
+#define IOCB_NOWAIT 1
+
+struct iov_iter
+{
+    const struct iovec *iov;
+    unsigned long nr_segs;
+    size_t iov_offset;
+    size_t count;
+};
+
+static inline void iov_iter_init(struct iov_iter *i, const struct iovec *iov,
+                                 unsigned long nr_segs, size_t count)
+{
+    i->iov = iov;
+    i->nr_segs = nr_segs;
+    i->iov_offset = 0;
+    i->count = count;
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+    return i->count;
+}
+
+static inline size_t shim_iter_copy(struct iov_iter *i, char *kbuf, size_t n, bool to_iter)
+{
+    size_t done = 0;
+
+    while (done < n && i->count && i->nr_segs) {
+        size_t seg = i->iov->iov_len - i->iov_offset;
+        size_t len = min(n - done, seg);
+        char *ubuf = (char *)i->iov->iov_base + i->iov_offset;
+
+        if (to_iter)
+            memcpy(ubuf, kbuf + done, len);
+        else
+            memcpy(kbuf + done, ubuf, len);
+        done += len;
+        i->iov_offset += len;
+        i->count -= len;
+        if (i->iov_offset == i->iov->iov_len) {
+            i->iov++;
+            i->nr_segs--;
+            i->iov_offset = 0;
+        }
+    }
+    return done;
+}
+
+#define copy_to_iter(kbuf, n, i) shim_iter_copy(i, (char *)(kbuf), n, true)
+#define copy_from_iter_full(kbuf, n, i) (shim_iter_copy(i, (char *)(kbuf), n, false) == (n))
+
+/* Files and char devices */
+struct address_space
+{
+    int nr_mapped;
+};
+
+struct vm_area_struct;
+struct file;
+struct inode;
+
+struct kiocb
+{
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+
+struct file_operations
+{
+    void *owner;
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*splice_read)(struct file *, loff_t *, void *, size_t, unsigned int);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    __poll_t (*poll)(struct file *, poll_table *);
+};
+
+struct cdev
+{
+    void *owner;
+    const struct file_operations *ops;
+    dev_t dev;
+};
+
+struct inode
+{
+    struct cdev *i_cdev;
+};
+
+struct file
+{
+    void *private_data;
+    loff_t f_pos;
+    unsigned int f_flags;
+    struct address_space *f_mapping;
+};
+
+#define MAJOR(dev) ((dev) >> 20)
+#define MINOR(dev) ((dev) & 0xfffff)
+#define MKDEV(major, minor) (((major) << 20) | (minor))
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+    cdev->ops = fops;
+}
+
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+    (void)count;
+    cdev->dev = dev;
+    return 0;
+}
+
+#define cdev_del(cdev) ((void)(cdev))
+
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int first, unsigned int count,
+                                      const char *name)
+{
+    (void)count;
+    (void)name;
+    *dev = MKDEV(240, first);
+    return 0;
+}
+
+#define unregister_chrdev_region(dev, count) ((void)(dev), (void)(count))
+
+static inline loff_t fixed_size_llseek(struct file *filp, loff_t offset, int whence,
+                                       loff_t size)
+{
+    loff_t pos;
+
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = filp->f_pos + offset;
+        break;
+    case SEEK_END:
+        pos = size + offset;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (pos < 0 || pos > size)
+        return -EINVAL;
+    filp->f_pos = pos;
+    return pos;
+}
+
+ssize_t copy_splice_read(struct file *in, loff_t *ppos, void *pipe, size_t len,
+                         unsigned int flags);
+
+/* mmap, faults are driven by calling vm_ops->fault directly */
+#define VM_WRITE 0x2
+#define VM_MAYWRITE 0x20
+#define VM_DONTEXPAND 0x40000
+#define VM_DONTDUMP 0x4000000
+#define VM_FAULT_SIGBUS 2
+
+struct vm_area_struct
+{
+    unsigned long vm_flags;
+    const struct vm_operations_struct *vm_ops;
+    void *vm_private_data;
+    unsigned long vm_pgoff;
+    struct file *vm_file;
+};
+
+struct vm_fault
+{
+    struct vm_area_struct *vma;
+    pgoff_t pgoff;
+    struct page *page;
+};
+
+struct vm_operations_struct
+{
+    vm_fault_t (*fault)(struct vm_fault *vmf);
+};
+
+static inline void vm_flags_mod(struct vm_area_struct *vma, unsigned long set,
+                                unsigned long clear)
+{
+    vma->vm_flags = (vma->vm_flags | set) & ~clear;
+}
+
+#define mapping_mapped(mapping) ((mapping)->nr_mapped)
+#define unmap_mapping_range(mapping, start, len, even_cows) ((void)(mapping))
+
+/* debugfs and seq_file, statistics are printed to stdout */
+struct dentry;
+
+struct seq_file
+{
+    void *private;
+};
+
+#define seq_printf(s, fmt, ...) printf(fmt, ##__VA_ARGS__)
+#define debugfs_create_dir(name, parent) ((struct dentry *)NULL)
+#define debugfs_create_file(name, mode, parent, data, fops) ((void)(parent), (void)(fops))
+#define debugfs_remove_recursive(dentry) ((void)(dentry))
+#define DEFINE_SHOW_ATTRIBUTE(name) \
+    static const int name##_fops __attribute__((unused)) = sizeof(&name##_show)
+
+/* Tracepoints compile to nothing */
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+    static inline void trace_##name(proto) { }
+
+/*
+ * LZ4, backed by liblz4 when CMake found it. Without it compression always
+ * "fails", so aesd_compress=1 stores every entry raw.
+ */
+#define LZ4_MEM_COMPRESS 16384
+#define LZ4_COMPRESSBOUND(isize) ((isize) + ((isize) / 255) + 16)
+#ifdef AESD_SHIM_HAVE_LZ4
+int LZ4_compress_default(const char *src, char *dst, int src_size, int dst_capacity);
+int LZ4_decompress_safe(const char *src, char *dst, int compressed_size, int dst_capacity);
+#define LZ4_compress_default(src, dst, src_size, dst_capacity, wrkmem) \
+    (LZ4_compress_default)(src, dst, src_size, dst_capacity)
+#else
+#define LZ4_compress_default(src, dst, src_size, dst_capacity, wrkmem) 0
+#define LZ4_decompress_safe(src, dst, compressed_size, dst_capacity) -1
+#endif
+#define LZ4_compressBound(isize) LZ4_COMPRESSBOUND(isize)
+
+#endif /* AESD_KSHIM_H */
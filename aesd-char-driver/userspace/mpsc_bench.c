@@ -0,0 +1,138 @@
+/*
+ * mpsc_bench.c
+ *
+ *  @brief Throughput of aesd-circular-buffer-mpsc against the plain
+ *  aesd_circular_buffer behind a pthread mutex. Both versions reject adds
+ *  to a full buffer and have a single consumer draining it, so they differ
+ *  only in synchronisation.
+ *
+ *  Usage: mpsc-bench [max producers] [entries per producer]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../aesd-circular-buffer-mpsc.h"
+
+struct locked_buffer
+{
+    pthread_mutex_t lock;
+    struct aesd_circular_buffer buffer;
+};
+
+static struct aesd_mpsc_circular_buffer mpsc;
+static struct locked_buffer locked = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static bool locked_add(const struct aesd_buffer_entry *entry)
+{
+    bool added = false;
+
+    pthread_mutex_lock(&locked.lock);
+    if (!locked.buffer.full) {
+        aesd_circular_buffer_add_entry(&locked.buffer, entry);
+        added = true;
+    }
+    pthread_mutex_unlock(&locked.lock);
+    return added;
+}
+
+static bool locked_remove(struct aesd_buffer_entry *entry)
+{
+    bool removed;
+
+    pthread_mutex_lock(&locked.lock);
+    removed = aesd_circular_buffer_remove_entry(&locked.buffer, entry);
+    pthread_mutex_unlock(&locked.lock);
+    return removed;
+}
+
+static bool mpsc_add(const struct aesd_buffer_entry *entry)
+{
+    return aesd_mpsc_circular_buffer_add_entry(&mpsc, entry);
+}
+
+static bool mpsc_remove(struct aesd_buffer_entry *entry)
+{
+    return aesd_mpsc_circular_buffer_remove_entry(&mpsc, entry);
+}
+
+struct variant
+{
+    const char *name;
+    bool (*add)(const struct aesd_buffer_entry *entry);
+    bool (*remove)(struct aesd_buffer_entry *entry);
+};
+
+struct producer
+{
+    const struct variant *variant;
+    size_t count;
+};
+
+static void *producer_thread(void *data)
+{
+    struct producer *p = data;
+    struct aesd_buffer_entry entry = { .buffptr = "x\n", .size = 2 };
+    size_t n;
+
+    for (n = 0; n < p->count; n++) {
+        while (!p->variant->add(&entry))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static double run(const struct variant *variant, unsigned int producers, size_t count)
+{
+    pthread_t threads[producers];
+    struct producer arg = { variant, count };
+    struct aesd_buffer_entry entry;
+    struct timespec start, end;
+    size_t consumed = 0;
+    unsigned int i;
+
+    aesd_mpsc_circular_buffer_init(&mpsc);
+    aesd_circular_buffer_init(&locked.buffer);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer_thread, &arg);
+    while (consumed < producers * count) {
+        if (variant->remove(&entry))
+            consumed++;
+        else
+            sched_yield();
+    }
+    for (i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return consumed / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct variant variants[] = {
+        { "mutex", locked_add, locked_remove },
+        { "mpsc", mpsc_add, mpsc_remove },
+    };
+    unsigned int max_producers = argc > 1 ? atoi(argv[1]) : 8;
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+    unsigned int producers;
+    size_t v;
+
+    if (max_producers < 1 || count < 1) {
+        fprintf(stderr, "Usage: %s [max producers] [entries per producer]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %8s %14s\n", "variant", "threads", "entries/s");
+    for (producers = 1; producers <= max_producers; producers *= 2) {
+        for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+            printf("%-10s %8u %14.0f\n", variants[v].name, producers,
+                   run(&variants[v], producers, count / producers));
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * mpsc_stress.c
+ *
+ *  @brief Stress test for aesd-circular-buffer-mpsc. Producer threads add
+ *  entries tagged with their id and a per-producer counter while the main
+ *  thread consumes. Checks that nothing is lost or duplicated, that each
+ *  producer's entries come out in order, and that concurrent scans only
+ *  ever see whole published entries.
+ *
+ *  Usage: mpsc-stress [producers] [entries per producer]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../aesd-circular-buffer-mpsc.h"
+
+#define MAX_PRODUCERS 64
+
+struct producer
+{
+    struct aesd_mpsc_circular_buffer *buffer;
+    unsigned int id;
+    size_t count;
+};
+
+/* Entries carry no data, buffptr encodes the producer id and counter */
+static const char *tag(unsigned int id, size_t n)
+{
+    return (const char *)(((uintptr_t)(n + 1) << 8) | id);
+}
+
+static void *producer_thread(void *data)
+{
+    struct producer *p = data;
+    size_t n;
+
+    for (n = 0; n < p->count; n++) {
+        struct aesd_buffer_entry entry = {
+            .buffptr = tag(p->id, n),
+            .size = 1 + (n + p->id) % 7,
+            .seq = n,
+        };
+
+        while (!aesd_mpsc_circular_buffer_add_entry(p->buffer, &entry))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static int fail(const char *what, size_t value)
+{
+    fprintf(stderr, "mpsc-stress: %s (%zu)\n", what, value);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int producers = argc > 1 ? atoi(argv[1]) : 8;
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 0) : 200000;
+    static struct aesd_mpsc_circular_buffer buffer;
+    struct producer args[MAX_PRODUCERS];
+    pthread_t threads[MAX_PRODUCERS];
+    size_t next[MAX_PRODUCERS] = { 0 };
+    size_t consumed = 0, scans = 0;
+    unsigned int i;
+
+    if (producers < 1 || producers > MAX_PRODUCERS || count < 1) {
+        fprintf(stderr, "Usage: %s [producers 1-%d] [entries per producer]\n",
+                argv[0], MAX_PRODUCERS);
+        return 1;
+    }
+
+    aesd_mpsc_circular_buffer_init(&buffer);
+    for (i = 0; i < producers; i++) {
+        args[i] = (struct producer){ &buffer, i, count };
+        pthread_create(&threads[i], NULL, producer_thread, &args[i]);
+    }
+
+    while (consumed < producers * count) {
+        struct aesd_buffer_entry removed, *entry;
+        size_t index, sum = 0, offset;
+        unsigned int id;
+
+        /* Every visible entry must be fully written */
+        AESD_MPSC_CIRCULAR_BUFFER_FOREACH(entry, &buffer, index) {
+            id = (uintptr_t)entry->buffptr & 0xff;
+            if (id >= producers || entry->size != 1 + (entry->seq + id) % 7 ||
+                entry->buffptr != tag(id, entry->seq))
+                return fail("torn entry seen by FOREACH", index);
+            sum += entry->size;
+        }
+        if (sum > 0) {
+            entry = aesd_mpsc_circular_buffer_find_entry_offset_for_fpos(&buffer, sum - 1,
+                                                                         &offset);
+            if (entry == NULL || offset != entry->size - 1)
+                return fail("find_entry_offset_for_fpos missed the last byte", sum);
+        }
+        scans++;
+
+        /*
+         * A producer preempted between claiming and publishing a slot
+         * blocks the consumer, so give it the CPU back
+         */
+        if (!aesd_mpsc_circular_buffer_remove_entry(&buffer, &removed)) {
+            sched_yield();
+            continue;
+        }
+        do {
+            id = (uintptr_t)removed.buffptr & 0xff;
+            if (id >= producers)
+                return fail("bad producer id", id);
+            if (removed.seq != next[id])
+                return fail("entry out of order or lost", removed.seq);
+            next[id]++;
+            consumed++;
+        } while (aesd_mpsc_circular_buffer_remove_entry(&buffer, &removed));
+    }
+
+    for (i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    if (atomic_load(&buffer.total_size) != 0)
+        return fail("total_size not zero after draining", atomic_load(&buffer.total_size));
+
+    printf("mpsc-stress: %u producers, %zu entries, %zu scans: ok\n",
+           producers, consumed, scans);
+    return 0;
+}
@@ -1,8 +1,263 @@
+#define _GNU_SOURCE
 #include "systemcalls.h"
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+extern char **environ;
+
+/**
+ * Starts command[0] with the NULL terminated argument list @param command,
+ * applying the file descriptor setup in @param actions (may be NULL) in the child.
+ * @return 0 with the child in @param pid, or an errno value
+ */
+static int spawn_command_actions(pid_t *pid, char *const command[],
+                                 const posix_spawn_file_actions_t *actions)
+{
+    return posix_spawn(pid, command[0], actions, NULL, command, environ);
+}
+
+/**
+ * Starts command[0] with the NULL terminated argument list @param command,
+ * optionally with standard out redirected to @param outputfile (created or
+ * truncated, mode 0644). posix_spawn() lets the C library start the child
+ * with vfork semantics instead of copying the caller's page tables, so the
+ * cost does not grow with the caller's memory size.
+ * @return 0 with the child in @param pid, or an errno value if the child
+ *   could not be started, including when command[0] could not be executed.
+ */
+static int spawn_command(pid_t *pid, char *const command[], const char *outputfile)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *actionsp = NULL;
+    int err;
+
+    if (outputfile != NULL) {
+        err = posix_spawn_file_actions_init(&actions);
+        if (err != 0)
+            return err;
+        err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outputfile,
+                                               O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (err != 0) {
+            posix_spawn_file_actions_destroy(&actions);
+            return err;
+        }
+        actionsp = &actions;
+    }
+
+    err = spawn_command_actions(pid, command, actionsp);
+
+    if (actionsp != NULL)
+        posix_spawn_file_actions_destroy(actionsp);
+    return err;
+}
+
+/**
+ * @return true if @param status from waitpid() says the child terminated
+ *   normally with exit status 0
+ */
+static bool status_success(int status)
+{
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static exec_stats_hook_t stats_hook;
+static void *stats_hook_arg;
+
+/**
+* Installs @param hook to be called with the statistics of every command run by
+*   do_exec(), do_exec_redirect() and their _stats variants, for instance to sum
+*   them up per command. @param arg is passed through. NULL removes the hook.
+*   Set it before starting commands; it is called from the thread that ran the command.
+*/
+void exec_set_stats_hook(exec_stats_hook_t hook, void *arg)
+{
+    stats_hook = hook;
+    stats_hook_arg = arg;
+}
+
+/**
+ * Runs @param command like do_exec() or, with @param outputfile, like
+ * do_exec_redirect(), filling @param stats from wait4() and the clock.
+ * @return true if the command exited with status 0
+ */
+static bool run_command_stats(char *const command[], const char *outputfile,
+                              struct exec_stats *stats)
+{
+    struct rusage usage;
+    uint64_t start, spawned;
+    pid_t pid;
+    int status;
+
+    memset(stats, 0, sizeof(*stats));
+    start = monotonic_ns();
+    // A command that cannot be executed fails the spawn itself
+    stats->error = spawn_command(&pid, command, outputfile);
+    spawned = monotonic_ns();
+    stats->spawn_ns = spawned - start;
+
+    if (stats->error == 0) {
+        while (wait4(pid, &status, 0, &usage) == -1) {
+            if (errno != EINTR) {
+                stats->error = errno;
+                break;
+            }
+        }
+    }
+    if (stats->error == 0) {
+        stats->run_ns = monotonic_ns() - spawned;
+        stats->status = status;
+        stats->exited = WIFEXITED(status);
+        stats->exit_code = stats->exited ? WEXITSTATUS(status) : 0;
+        stats->signaled = WIFSIGNALED(status);
+        stats->signal = stats->signaled ? WTERMSIG(status) : 0;
+        stats->user_us = usage.ru_utime.tv_sec * 1000000ull + usage.ru_utime.tv_usec;
+        stats->system_us = usage.ru_stime.tv_sec * 1000000ull + usage.ru_stime.tv_usec;
+        stats->max_rss_kb = usage.ru_maxrss;
+        stats->voluntary_switches = usage.ru_nvcsw;
+        stats->involuntary_switches = usage.ru_nivcsw;
+    }
+
+    if (stats_hook != NULL)
+        stats_hook((const char *const *)command, stats, stats_hook_arg);
+
+    return stats->error == 0 && status_success(stats->status);
+}
+
+// Shell words and builtins that need a real shell, see split_simple_command()
+static const char *const shell_words[] = {
+    "!", ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue",
+    "do", "done", "echo", "elif", "else", "esac", "eval", "exec", "exit", "export",
+    "fc", "fg", "fi", "for", "function", "getopts", "hash", "if", "in", "jobs",
+    "kill", "local", "printf", "pwd", "read", "readonly", "return", "select", "set",
+    "shift", "source", "then", "time", "times", "trap", "type", "typeset", "ulimit",
+    "umask", "unalias", "unset", "until", "wait", "while",
+};
+
+/**
+ * Splits @param cmd into words if /bin/sh would run it as a plain command:
+ *   words separated by blanks, optionally in single quotes or in double
+ *   quotes without expansions. Anything else the shell interprets (pipes,
+ *   redirections, globs, variables, escapes, assignments, comments) or a
+ *   first word that is a keyword or builtin with shell-specific behaviour
+ *   makes the command not simple.
+ * @return a NULL terminated argument vector in a single allocation to free(),
+ *   or NULL if the command needs a shell or memory ran out.
+ */
+char **split_simple_command(const char *cmd)
+{
+    size_t len = strlen(cmd);
+    // At most one word per two characters, plus the terminating NULL
+    size_t max_words = len / 2 + 2;
+    char **argv = malloc(max_words * sizeof(char *) + len + 1);
+    char *out = (char *)(argv + max_words);
+    const char *p = cmd;
+    size_t argc = 0, i;
+
+    if (argv == NULL)
+        return NULL;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0')
+            break;
+
+        argv[argc++] = out;
+        while (*p != '\0' && *p != ' ' && *p != '\t') {
+            if (*p == '\'') {
+                for (p++; *p != '\'' && *p != '\0'; p++)
+                    *out++ = *p;
+                if (*p++ == '\0')
+                    goto shell;
+            } else if (*p == '"') {
+                for (p++; *p != '"' && *p != '\0'; p++) {
+                    if (strchr("$`\\!", *p) != NULL)
+                        goto shell;
+                    *out++ = *p;
+                }
+                if (*p++ == '\0')
+                    goto shell;
+            } else if (strchr("|&;<>()$`\\*?[]{}~#!=\n", *p) != NULL) {
+                // '=' only matters in leading assignments, but refusing it everywhere is simpler
+                goto shell;
+            } else {
+                *out++ = *p++;
+            }
+        }
+        *out++ = '\0';
+    }
+    argv[argc] = NULL;
+
+    if (argc == 0)
+        goto shell;
+    for (i = 0; i < sizeof(shell_words) / sizeof(shell_words[0]); i++) {
+        if (strcmp(argv[0], shell_words[i]) == 0)
+            goto shell;
+    }
+    return argv;
+
+shell:
+    free(argv);
+    return NULL;
+}
+
+/**
+ * Runs @param argv found through PATH, set up as system() sets up its shell:
+ *   SIGINT and SIGQUIT back to their default actions.
+ * @return 0 once the command has been started, with its wait status in
+ *   @param status or -1 there if it could not be waited for, or an errno
+ *   value if the command could not be started.
+ */
+static int run_simple_command(char *const argv[], int *status)
+{
+    posix_spawnattr_t attr;
+    sigset_t sigdefault;
+    pid_t pid;
+    int err;
+
+    err = posix_spawnattr_init(&attr);
+    if (err != 0)
+        return err;
+    sigemptyset(&sigdefault);
+    sigaddset(&sigdefault, SIGINT);
+    sigaddset(&sigdefault, SIGQUIT);
+    posix_spawnattr_setsigdefault(&attr, &sigdefault);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+    err = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0)
+        return err;
+
+    // The command has run by now, so a wait failure must not start it again
+    while (waitpid(pid, status, 0) == -1) {
+        if (errno != EINTR) {
+            *status = -1;
+            break;
+        }
+    }
+    return 0;
+}
 
 /**
  * @param cmd the command to execute with system()
@@ -21,7 +276,16 @@ bool do_system(const char *cmd)
  *   or false() if it returned a failure
 */
 
-    int result = system(cmd);
+    int result;
+    char **argv = cmd != NULL ? split_simple_command(cmd) : NULL;
+
+    /*
+     * Plain commands skip /bin/sh. If one cannot be started, system() runs
+     * it after all so the caller sees the shell's usual error and status.
+     */
+    if (argv == NULL || run_simple_command(argv, &result) != 0)
+        result = system(cmd);
+    free(argv);
     
     // system() returns -1 if there was an error in invocation
     if (result == -1) {
@@ -74,44 +338,11 @@ bool do_exec(int count, ...)
  *
 */
 
-    pid_t pid;
-    int status;
-    
-    // Flush all output streams before fork
-    fflush(NULL);
-    
-    pid = fork();
-    
-    if (pid == -1) {
-        // Fork failed
-        va_end(args);
-        return false;
-    } else if (pid == 0) {
-        // Child process
-        execv(command[0], command);
-        // If execv returns, it failed
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        if (waitpid(pid, &status, 0) == -1) {
-            // waitpid failed
-            va_end(args);
-            return false;
-        }
-        
-        va_end(args);
-        
-        // Check if child terminated normally and with exit status 0
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            return true;
-        }
-        
-        return false;
-    }
+    struct exec_stats stats;
 
     va_end(args);
 
-    return true;
+    return run_command_stats(command, NULL, &stats);
 }
 
 /**
@@ -140,60 +371,673 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
  *
 */
 
+    struct exec_stats stats;
+
+    va_end(args);
+
+    // The output file is opened in the child, like the open() before execv()
+    return run_command_stats(command, outputfile, &stats);
+}
+
+/**
+* Runs a command like do_exec() and reports where its time went.
+* @param stats - Filled with the exit or signal status, spawn and run time, CPU
+*   time, peak RSS and context switches of the command, see struct exec_stats.
+* All other parameters, see do_exec above
+*/
+bool do_exec_stats(struct exec_stats *stats, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char * command[count+1];
+    int i;
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    return run_command_stats(command, NULL, stats);
+}
+
+/**
+* Runs a command like do_exec_redirect() and fills @param stats like do_exec_stats().
+* All other parameters, see do_exec_redirect above
+*/
+bool do_exec_redirect_stats(struct exec_stats *stats, const char *outputfile, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char * command[count+1];
+    int i;
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    return run_command_stats(command, outputfile, stats);
+}
+
+/**
+ * Returns a pidfd for @param pid, or -1 if the kernel or C library has no
+ * pidfd_open(). pidfds are always close-on-exec.
+ */
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+struct batch_slot {
+    pid_t pid;          // 0 while the slot is free
+    int pidfd;          // -1 if the child is reaped with a blocking waitpid()
+    size_t index;       // position of the command in the batch
+    uint64_t start_ns;
+};
+
+/**
+ * Starts commands[index] in @param slot, registering its pidfd with
+ * @param epfd when possible. Fills results[index] if it cannot start.
+ * @return true if the child is running
+ */
+static bool batch_start(struct batch_slot *slot, int epfd, char *const *const commands[],
+                        size_t index, struct exec_batch_result results[])
+{
+    struct epoll_event ev;
     pid_t pid;
+    int err;
+
+    slot->start_ns = monotonic_ns();
+    err = spawn_command(&pid, (char *const *)commands[index], NULL);
+    if (err != 0) {
+        results[index].error = err;
+        results[index].success = false;
+        return false;
+    }
+
+    slot->pid = pid;
+    slot->index = index;
+    slot->pidfd = epfd >= 0 ? open_pidfd(pid) : -1;
+    if (slot->pidfd >= 0) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = slot;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, slot->pidfd, &ev) == -1) {
+            close(slot->pidfd);
+            slot->pidfd = -1;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reaps the child in @param slot, which must have exited if it has a pidfd,
+ * records its result and frees the slot.
+ */
+static void batch_reap(struct batch_slot *slot, int epfd, struct exec_batch_result results[])
+{
+    struct exec_batch_result *result = &results[slot->index];
     int status;
-    
-    // Flush all output streams before fork
-    fflush(NULL);
-    
-    pid = fork();
-    
-    if (pid == -1) {
-        // Fork failed
-        va_end(args);
+
+    result->error = 0;
+    while (waitpid(slot->pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            result->error = errno;
+            break;
+        }
+    }
+    result->wall_ns = monotonic_ns() - slot->start_ns;
+    result->status = result->error == 0 ? status : 0;
+    result->success = result->error == 0 && status_success(status);
+
+    if (slot->pidfd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, slot->pidfd, NULL);
+        close(slot->pidfd);
+    }
+    slot->pid = 0;
+}
+
+/**
+* Runs @param count commands with at most @param parallelism of them at once
+* (0 for no limit), starting each as soon as a previous one completes.
+* @param commands - Array of @param count NULL terminated argument vectors, each
+*   in the form do_exec() takes: full path of the command first, then its arguments.
+* @param results - Array of @param count results, filled in the order of @param commands.
+*   Completions are waited for through pidfds and epoll. Where pidfd_open() is
+*   not available a blocking waitpid() on the oldest running command is used instead.
+* @return true if every command was started and exited with status 0, false otherwise.
+*/
+bool do_exec_batch(char *const *const commands[], size_t count, size_t parallelism,
+                   struct exec_batch_result results[])
+{
+    struct batch_slot *slots;
+    size_t next = 0, running = 0, i;
+    bool all_success = true;
+    int epfd;
+
+    if (count == 0)
+        return true;
+    if (parallelism == 0 || parallelism > count)
+        parallelism = count;
+
+    memset(results, 0, count * sizeof(*results));
+    slots = calloc(parallelism, sizeof(*slots));
+    if (slots == NULL)
         return false;
-    } else if (pid == 0) {
-        // Child process
-        
-        // Open the output file for writing
-        int fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd == -1) {
-            exit(EXIT_FAILURE);
-        }
-        
-        // Redirect stdout to the file
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            close(fd);
-            exit(EXIT_FAILURE);
-        }
-        
-        // Close the file descriptor as it's been duplicated
-        close(fd);
-        
-        // Execute the command
-        execv(command[0], command);
-        
-        // If execv returns, it failed
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        if (waitpid(pid, &status, 0) == -1) {
-            // waitpid failed
-            va_end(args);
+    // Without epoll every child is reaped by the waitpid() fallback
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    while (next < count || running > 0) {
+        struct batch_slot *done = NULL;
+
+        // Fill every free slot before waiting
+        for (i = 0; i < parallelism && next < count; i++) {
+            if (slots[i].pid != 0)
+                continue;
+            if (batch_start(&slots[i], epfd, commands, next, results))
+                running++;
+            else
+                all_success = false;
+            next++;
+        }
+        if (running == 0)
+            continue;
+
+        // Children without a pidfd cannot be waited for through epoll
+        for (i = 0; i < parallelism; i++) {
+            if (slots[i].pid != 0 && slots[i].pidfd < 0 &&
+                (done == NULL || slots[i].index < done->index))
+                done = &slots[i];
+        }
+        if (done == NULL) {
+            struct epoll_event ev;
+            int n = epoll_wait(epfd, &ev, 1, -1);
+
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == 1) {
+                done = ev.data.ptr;
+            } else {
+                // epoll broke, reap the oldest child with waitpid() instead
+                for (i = 0; i < parallelism; i++) {
+                    if (slots[i].pid != 0 && (done == NULL || slots[i].index < done->index))
+                        done = &slots[i];
+                }
+            }
+        }
+
+        batch_reap(done, epfd, results);
+        running--;
+        if (!results[done->index].success)
+            all_success = false;
+    }
+
+    if (epfd >= 0)
+        close(epfd);
+    free(slots);
+    return all_success;
+}
+
+/**
+ * Appends @param len bytes to @param output, growing it if it is ours to
+ * grow, and discarding what does not fit in it or in @param max_bytes.
+ */
+static void output_append(struct exec_output *output, bool growable, size_t max_bytes,
+                          const char *data, size_t len)
+{
+    size_t room;
+
+    if (max_bytes != 0 && output->len + len > max_bytes) {
+        output->truncated = true;
+        len = output->len < max_bytes ? max_bytes - output->len : 0;
+    }
+    // Keep room for the terminating NUL
+    if (growable && output->len + len + 1 > output->capacity) {
+        size_t capacity = output->capacity ? output->capacity : 4096;
+        char *data_new;
+
+        while (capacity < output->len + len + 1)
+            capacity *= 2;
+        data_new = realloc(output->data, capacity);
+        if (data_new != NULL) {
+            output->data = data_new;
+            output->capacity = capacity;
+        }
+    }
+    room = output->capacity > output->len ? output->capacity - output->len - 1 : 0;
+    if (len > room) {
+        output->truncated = true;
+        len = room;
+    }
+    if (len > 0) {
+        memcpy(output->data + output->len, data, len);
+        output->len += len;
+    }
+    // A caller buffer of capacity 0 has no room even for the NUL
+    if (output->data != NULL && output->capacity > 0)
+        output->data[output->len] = '\0';
+}
+
+/**
+* Runs a command like do_exec() and collects its standard out and standard
+*   error in memory instead of a file.
+* @param capture - Describes where the output goes and the limits, see struct exec_capture.
+*   Both streams are drained together with poll(), so a child writing a lot to
+*   one of them cannot block while the other is being read.
+* All other parameters, see do_exec above
+* @return true if the command exited with status 0 before the timeout. Output
+*   cut off by max_bytes or a caller buffer does not cause a failure but sets
+*   the truncated flag of that stream.
+*/
+bool do_exec_capture(struct exec_capture *capture, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char * command[count+1];
+    int i;
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    struct exec_output *outputs[2] = { &capture->out, &capture->err };
+    bool growable[2];
+    bool exited = false;
+    bool reaped = false;
+    struct pollfd fds[3];
+    int pipes[2][2] = { { -1, -1 }, { -1, -1 } };
+    posix_spawn_file_actions_t actions;
+    struct timespec deadline;
+    char chunk[16384];
+    pid_t pid;
+    int status;
+    int err;
+
+    capture->status = 0;
+    capture->timed_out = false;
+    for (i = 0; i < 2; i++) {
+        // A buffer supplied by the caller is never reallocated
+        growable[i] = outputs[i]->data == NULL;
+        if (growable[i])
+            outputs[i]->capacity = 0;
+        outputs[i]->len = 0;
+        outputs[i]->truncated = false;
+        if (outputs[i]->data != NULL && outputs[i]->capacity > 0)
+            outputs[i]->data[0] = '\0';
+    }
+
+    if (pipe2(pipes[0], O_CLOEXEC) == -1 || pipe2(pipes[1], O_CLOEXEC) == -1)
+        goto fail_pipes;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        goto fail_pipes;
+    // dup2() clears close-on-exec on the child's stdout and stderr only
+    err = posix_spawn_file_actions_adddup2(&actions, pipes[0][1], STDOUT_FILENO);
+    if (err == 0)
+        err = posix_spawn_file_actions_adddup2(&actions, pipes[1][1], STDERR_FILENO);
+    if (err == 0)
+        err = spawn_command_actions(&pid, command, &actions);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0)
+        goto fail_pipes;
+
+    // Only the child may hold the write ends, or EOF would never arrive
+    for (i = 0; i < 2; i++) {
+        close(pipes[i][1]);
+        fds[i].fd = pipes[i][0];
+        fds[i].events = POLLIN;
+    }
+    /*
+     * The child can close both pipes and keep running, so the timeout has to
+     * cover its exit as well. A pidfd becomes readable when it exits, poll()
+     * skips it when it is -1.
+     */
+    fds[2].fd = capture->timeout_ms > 0 ? open_pidfd(pid) : -1;
+    fds[2].events = POLLIN;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += capture->timeout_ms / 1000;
+    deadline.tv_nsec += (capture->timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (fds[0].fd >= 0 || fds[1].fd >= 0 || (capture->timeout_ms > 0 && !exited)) {
+        int timeout = -1;
+        int n;
+
+        if (capture->timeout_ms > 0) {
+            struct timespec now;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout = (deadline.tv_sec - now.tv_sec) * 1000 +
+                      (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if (timeout <= 0) {
+                // Descendants may keep the pipes open, so stop reading too
+                kill(pid, SIGKILL);
+                capture->timed_out = true;
+                break;
+            }
+        }
+
+        // Without a pidfd, check for the exit of a child that closed its pipes
+        if (fds[0].fd < 0 && fds[1].fd < 0 && fds[2].fd < 0) {
+            pid_t done = waitpid(pid, &status, WNOHANG);
+
+            if (done == pid) {
+                exited = reaped = true;
+                break;
+            }
+            if (done == -1 && errno != EINTR)
+                return false;
+            if (timeout > 10)
+                timeout = 10;
+        }
+
+        n = poll(fds, 3, timeout);
+        if (n == -1 && errno != EINTR) {
+            kill(pid, SIGKILL);
+            break;
+        }
+        if (n > 0 && fds[2].fd >= 0 && fds[2].revents != 0) {
+            exited = true;
+            close(fds[2].fd);
+            fds[2].fd = -1;
+        }
+        for (i = 0; n > 0 && i < 2; i++) {
+            ssize_t len;
+
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            len = read(fds[i].fd, chunk, sizeof(chunk));
+            if (len > 0) {
+                output_append(outputs[i], growable[i], capture->max_bytes, chunk, len);
+            } else if (len == 0 || errno != EINTR) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+            }
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+    }
+    while (!reaped && waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR)
             return false;
+    }
+    capture->status = status;
+    return !capture->timed_out && status_success(status);
+
+fail_pipes:
+    for (i = 0; i < 2; i++) {
+        if (pipes[i][0] >= 0)
+            close(pipes[i][0]);
+        if (pipes[i][1] >= 0)
+            close(pipes[i][1]);
+    }
+    return false;
+}
+
+// Largest command vector an exec_pool helper accepts, strings included
+#define EXEC_POOL_MAX_REQUEST 65536
+// One iovec per argument, so at most IOV_MAX
+#define EXEC_POOL_MAX_ARGS 1024
+
+struct exec_pool_reply {
+    int error;      // errno value if the command could not be started
+    int status;     // wait status otherwise
+};
+
+struct exec_pool_helper {
+    pid_t pid;
+    int fd;         // our end of the helper's socketpair
+    bool busy;
+    bool dead;      // helper exited or its socket failed, never reused
+};
+
+struct exec_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    size_t count;
+    struct exec_pool_helper helper[];
+};
+
+/**
+ * Main loop of a helper process: receive a command vector, spawn it, wait
+ * and reply, until the pool closes the socket. Runs in a fork of the pool
+ * creator, so it sticks to static storage and never returns.
+ */
+static void exec_pool_helper_main(int fd)
+{
+    static char request[EXEC_POOL_MAX_REQUEST];
+    static char *argv[EXEC_POOL_MAX_ARGS + 1];
+
+    for (;;) {
+        struct exec_pool_reply reply = { 0, 0 };
+        ssize_t len = recv(fd, request, sizeof(request), MSG_TRUNC);
+        size_t argc = 0, pos = 0;
+        pid_t pid;
+
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            _exit(EXIT_SUCCESS);
+
+        // The request is the argument strings back to back, each NUL terminated
+        if ((size_t)len > sizeof(request) || request[len - 1] != '\0') {
+            reply.error = E2BIG;
+        } else {
+            while (pos < (size_t)len && argc < EXEC_POOL_MAX_ARGS) {
+                argv[argc++] = &request[pos];
+                pos += strlen(&request[pos]) + 1;
+            }
+            argv[argc] = NULL;
+            if (pos < (size_t)len)
+                reply.error = E2BIG;
         }
-        
-        va_end(args);
-        
-        // Check if child terminated normally and with exit status 0
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            return true;
+
+        if (reply.error == 0)
+            reply.error = spawn_command(&pid, argv, NULL);
+        if (reply.error == 0) {
+            while (waitpid(pid, &reply.status, 0) == -1) {
+                if (errno != EINTR) {
+                    reply.error = errno;
+                    break;
+                }
+            }
         }
-        
-        return false;
+        if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+            _exit(EXIT_FAILURE);
+    }
+}
+
+/**
+* Starts @param helpers small helper processes which run commands for do_exec_pool().
+*   Each helper is forked once, here, and from then on starts commands with
+*   posix_spawn() from its own small address space, so running a command costs
+*   the same no matter how large this process grows.
+*   Call this early, before the process grows and before it starts threads:
+*   helpers are forks of the caller and run commands with its environment and
+*   working directory as of this call.
+* @return the pool, or NULL with errno set if it could not be created.
+*/
+struct exec_pool *exec_pool_create(size_t helpers)
+{
+    struct exec_pool *pool;
+    size_t i, j;
+
+    if (helpers == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    pool = calloc(1, sizeof(*pool) + helpers * sizeof(pool->helper[0]));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (i = 0; i < helpers; i++) {
+        int sv[2];
+
+        // SEQPACKET keeps each request one message; CLOEXEC keeps the sockets out of commands
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+            goto fail;
+
+        fflush(NULL);
+        pool->helper[i].pid = fork();
+        if (pool->helper[i].pid == -1) {
+            close(sv[0]);
+            close(sv[1]);
+            goto fail;
+        }
+        if (pool->helper[i].pid == 0) {
+            // Helper process: hold only its own end of its own socket
+            for (j = 0; j < i; j++)
+                close(pool->helper[j].fd);
+            close(sv[0]);
+            exec_pool_helper_main(sv[1]);
+        }
+        close(sv[1]);
+        pool->helper[i].fd = sv[0];
+        pool->count++;
+    }
+    return pool;
+
+fail:
+    i = errno;
+    exec_pool_destroy(pool);
+    errno = i;
+    return NULL;
+}
+
+/**
+ * Stops the helpers of @param pool and frees it. No do_exec_pool() call may
+ * be running on it.
+ */
+void exec_pool_destroy(struct exec_pool *pool)
+{
+    size_t i;
+
+    if (pool == NULL)
+        return;
+    // Closing the socket makes the helper's recv() return 0 and the helper exit
+    for (i = 0; i < pool->count; i++)
+        close(pool->helper[i].fd);
+    for (i = 0; i < pool->count; i++) {
+        while (waitpid(pool->helper[i].pid, NULL, 0) == -1 && errno == EINTR)
+            ;
+    }
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/**
+ * Takes an idle, live helper, waiting while all live helpers are busy.
+ * @return NULL if every helper has died
+ */
+static struct exec_pool_helper *exec_pool_get(struct exec_pool *pool)
+{
+    struct exec_pool_helper *helper = NULL;
+    size_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        bool alive = false;
+
+        for (i = 0; i < pool->count; i++) {
+            if (pool->helper[i].dead)
+                continue;
+            alive = true;
+            if (!pool->helper[i].busy) {
+                helper = &pool->helper[i];
+                helper->busy = true;
+                break;
+            }
+        }
+        if (helper != NULL || !alive)
+            break;
+        pthread_cond_wait(&pool->idle, &pool->lock);
     }
+    pthread_mutex_unlock(&pool->lock);
+    return helper;
+}
 
+static void exec_pool_put(struct exec_pool *pool, struct exec_pool_helper *helper, bool dead)
+{
+    pthread_mutex_lock(&pool->lock);
+    helper->busy = false;
+    helper->dead = dead;
+    // Waiters must also learn when the last helper died
+    pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+* Runs a command like do_exec(), but has one of the helpers of @param pool start
+*   it, so this process never forks. Safe to call from several threads; calls
+*   wait while every helper is busy.
+* @param pool - Pool from exec_pool_create()
+* All other parameters, see do_exec above
+* @return true if the command exited with status 0, false if it could not be
+*   run, failed, or no helper of the pool is left.
+*/
+bool do_exec_pool(struct exec_pool *pool, int count, ...)
+{
+    struct exec_pool_helper *helper;
+    struct exec_pool_reply reply;
+    struct msghdr msg;
+    size_t len = 0;
+    bool dead = false;
+    va_list args;
+    int i;
+
+    if (count < 1 || count > EXEC_POOL_MAX_ARGS)
+        return false;
+
+    // Each argument with its NUL is one iovec, sent as a single packet
+    struct iovec iov[count];
+    va_start(args, count);
+    for (i = 0; i < count; i++) {
+        char *arg = va_arg(args, char *);
+
+        iov[i].iov_base = arg;
+        iov[i].iov_len = strlen(arg) + 1;
+        len += iov[i].iov_len;
+    }
     va_end(args);
+    if (len > EXEC_POOL_MAX_REQUEST)
+        return false;
 
-    return true;
+    helper = exec_pool_get(pool);
+    if (helper == NULL)
+        return false;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    if (sendmsg(helper->fd, &msg, MSG_NOSIGNAL) != (ssize_t)len) {
+        dead = true;
+    } else {
+        ssize_t n;
+
+        while ((n = recv(helper->fd, &reply, sizeof(reply), 0)) == -1 && errno == EINTR)
+            ;
+        dead = n != sizeof(reply);
+    }
+    exec_pool_put(pool, helper, dead);
+
+    return !dead && reply.error == 0 && status_success(reply.status);
 }
@@ -1,9 +1,146 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 bool do_system(const char *command);
 
+char **split_simple_command(const char *cmd);
+
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * Outcome of one command run by do_exec_batch()
+ */
+struct exec_batch_result {
+    /**
+     * 0 if the command was started, otherwise the errno value explaining why not
+     */
+    int error;
+    /**
+     * Wait status as returned by waitpid(), valid when error is 0
+     */
+    int status;
+    /**
+     * True if the command exited with status 0
+     */
+    bool success;
+    /**
+     * Nanoseconds from starting the command until it was reaped
+     */
+    uint64_t wall_ns;
+};
+
+bool do_exec_batch(char *const *const commands[], size_t count, size_t parallelism,
+                   struct exec_batch_result results[]);
+
+/**
+ * One output stream collected by do_exec_capture()
+ */
+struct exec_output {
+    /**
+     * Set to NULL to have the buffer allocated and grown as needed, release it
+     * with free(). A buffer supplied by the caller is filled up to capacity - 1
+     * bytes and never reallocated. Always NUL terminated when not NULL.
+     */
+    char *data;
+    size_t capacity;
+    /**
+     * Number of bytes collected
+     */
+    size_t len;
+    /**
+     * Set if output was discarded because of capacity or max_bytes
+     */
+    bool truncated;
+};
+
+/**
+ * Options and results of do_exec_capture()
+ */
+struct exec_capture {
+    /**
+     * Standard out and standard error of the command
+     */
+    struct exec_output out;
+    struct exec_output err;
+    /**
+     * Most bytes kept per stream, 0 for no limit. Output past the limit is
+     * still read so the command does not block, then discarded.
+     */
+    size_t max_bytes;
+    /**
+     * Milliseconds before the command is killed with SIGKILL, 0 to wait forever
+     */
+    int timeout_ms;
+    /**
+     * Set if the command was killed because of timeout_ms
+     */
+    bool timed_out;
+    /**
+     * Wait status as returned by waitpid()
+     */
+    int status;
+};
+
+bool do_exec_capture(struct exec_capture *capture, int count, ...);
+
+struct exec_pool;
+
+struct exec_pool *exec_pool_create(size_t helpers);
+
+void exec_pool_destroy(struct exec_pool *pool);
+
+bool do_exec_pool(struct exec_pool *pool, int count, ...);
+
+/**
+ * Where the time of one command went, filled by do_exec_stats() and
+ * do_exec_redirect_stats() and passed to the exec_set_stats_hook() hook
+ */
+struct exec_stats {
+    /**
+     * 0 if the command ran, otherwise the errno value from starting or waiting
+     * for it; the fields below are then zero except spawn_ns
+     */
+    int error;
+    /**
+     * Wait status as returned by wait4(), and its decoded parts
+     */
+    int status;
+    bool exited;
+    int exit_code;
+    bool signaled;
+    int signal;
+    /**
+     * Nanoseconds spent starting the command, up to its exec, and from then
+     * until it was reaped
+     */
+    uint64_t spawn_ns;
+    uint64_t run_ns;
+    /**
+     * CPU time of the command in microseconds
+     */
+    uint64_t user_us;
+    uint64_t system_us;
+    /**
+     * Peak resident set size of the command in kilobytes
+     */
+    long max_rss_kb;
+    /**
+     * Context switches of the command: waiting for something, and preempted
+     */
+    long voluntary_switches;
+    long involuntary_switches;
+};
+
+typedef void (*exec_stats_hook_t)(const char *const command[], const struct exec_stats *stats,
+                                  void *arg);
+
+void exec_set_stats_hook(exec_stats_hook_t hook, void *arg);
+
+bool do_exec_stats(struct exec_stats *stats, int count, ...);
+
+bool do_exec_redirect_stats(struct exec_stats *stats, const char *outputfile, int count, ...);
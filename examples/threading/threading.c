@@ -1,7 +1,11 @@
 #include "threading.h"
+#include <errno.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 // Optional: use these functions to add debug or error prints to your application
 #define DEBUG_LOG(msg,...)
@@ -17,7 +21,7 @@ void* threadfunc(void* thread_param)
     usleep(thread_func_args->wait_to_obtain_ms * 1000);
 
     // Obtain the mutex
-    if (pthread_mutex_lock(thread_func_args->mutex) != 0) {
+    if (lock_profile_mutex_lock(&thread_func_args->profile, thread_func_args->mutex) != 0) {
         ERROR_LOG("Failed to lock mutex");
         thread_func_args->thread_complete_success = false;
         return thread_param;
@@ -27,7 +31,7 @@ void* threadfunc(void* thread_param)
     usleep(thread_func_args->wait_to_release_ms * 1000);
 
     // Release the mutex
-    if (pthread_mutex_unlock(thread_func_args->mutex) != 0) {
+    if (lock_profile_mutex_unlock(&thread_func_args->profile, thread_func_args->mutex) != 0) {
         ERROR_LOG("Failed to unlock mutex");
         thread_func_args->thread_complete_success = false;
         return thread_param;
@@ -66,6 +70,7 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int
     td->wait_to_obtain_ms    = wait_to_obtain_ms;
     td->wait_to_release_ms   = wait_to_release_ms;
     td->thread_complete_success = false;
+    lock_profile_init(&td->profile, NULL);
 
     if (pthread_create(thread, NULL, threadfunc, td) != 0) {
         ERROR_LOG("Failed to create thread");
@@ -76,7 +81,655 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int
     return true;
 }
 
+bool join_thread_obtaining_mutex(pthread_t thread, struct lock_profile *profile)
+{
+    struct thread_data *td;
+    bool success;
+
+    if (pthread_join(thread, (void **)&td) != 0) {
+        ERROR_LOG("Failed to join thread");
+        return false;
+    }
+    if (profile != NULL)
+        lock_profile_merge(profile, &td->profile);
+    success = td->thread_complete_success;
+    free(td);
+    return success;
+}
+
+/*
+ * Lock profiling
+ *
+ * Wait and hold times go into histograms with power-of-two nanosecond
+ * buckets, so recording is a clock read and a few increments and profiles
+ * from any number of threads merge by adding buckets.
+ */
+
+static uint64_t lock_profile_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void lock_histogram_add(struct lock_histogram *histogram, uint64_t ns)
+{
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+
+    if (bucket >= LOCK_HISTOGRAM_BUCKETS)
+        bucket = LOCK_HISTOGRAM_BUCKETS - 1;
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total_ns += ns;
+    if (ns > histogram->max_ns)
+        histogram->max_ns = ns;
+}
+
+// Records an acquisition asked for at @param wait_start_ns which has just succeeded
+static void lock_profile_acquired(struct lock_profile *profile, uint64_t wait_start_ns,
+                                  bool contended)
+{
+    profile->locked_at_ns = lock_profile_clock_ns();
+    profile->acquisitions++;
+    if (contended)
+        profile->contended++;
+    lock_histogram_add(&profile->wait, profile->locked_at_ns - wait_start_ns);
+}
+
+static void lock_profile_released(struct lock_profile *profile)
+{
+    lock_histogram_add(&profile->hold, lock_profile_clock_ns() - profile->locked_at_ns);
+}
+
+void lock_profile_init(struct lock_profile *profile, const char *name)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->name = name;
+}
+
+int lock_profile_mutex_lock(struct lock_profile *profile, pthread_mutex_t *mutex)
+{
+    uint64_t start = lock_profile_clock_ns();
+    int rc;
+
+    // An uncontended mutex is taken by the trylock, so only waits pay for a second call
+    rc = pthread_mutex_trylock(mutex);
+    if (rc == 0) {
+        lock_profile_acquired(profile, start, false);
+        return 0;
+    }
+    if (rc != EBUSY)
+        return rc;
+    rc = pthread_mutex_lock(mutex);
+    if (rc == 0)
+        lock_profile_acquired(profile, start, true);
+    return rc;
+}
+
+int lock_profile_mutex_unlock(struct lock_profile *profile, pthread_mutex_t *mutex)
+{
+    // Stop the clock first, time spent in unlock waking a waiter is not holding
+    lock_profile_released(profile);
+    return pthread_mutex_unlock(mutex);
+}
+
+void lock_profile_merge(struct lock_profile *into, const struct lock_profile *from)
+{
+    const struct lock_histogram *src[] = { &from->wait, &from->hold };
+    struct lock_histogram *dst[] = { &into->wait, &into->hold };
+    int i, bucket;
+
+    into->acquisitions += from->acquisitions;
+    into->contended += from->contended;
+    for (i = 0; i < 2; i++) {
+        dst[i]->count += src[i]->count;
+        dst[i]->total_ns += src[i]->total_ns;
+        if (src[i]->max_ns > dst[i]->max_ns)
+            dst[i]->max_ns = src[i]->max_ns;
+        for (bucket = 0; bucket < LOCK_HISTOGRAM_BUCKETS; bucket++)
+            dst[i]->buckets[bucket] += src[i]->buckets[bucket];
+    }
+}
+
+uint64_t lock_histogram_percentile(const struct lock_histogram *histogram, double percentile)
+{
+    double exact_rank = histogram->count * percentile / 100;
+    uint64_t rank = (uint64_t)exact_rank, seen = 0, bound;
+    int bucket;
+
+    if (histogram->count == 0)
+        return 0;
+    // Rank of the interval at the percentile, counting from 1
+    if (rank < exact_rank || rank == 0)
+        rank++;
+    for (bucket = 0; bucket < LOCK_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank)
+            break;
+    }
+    // Longest interval the bucket can hold, but never more than was seen
+    bound = bucket == LOCK_HISTOGRAM_BUCKETS - 1 ? UINT64_MAX : (1ULL << bucket) - 1;
+    return bound < histogram->max_ns ? bound : histogram->max_ns;
+}
+
+static void lock_histogram_report(const char *label, const struct lock_histogram *histogram,
+                                  FILE *out)
+{
+    int bucket;
+
+    if (histogram->count == 0) {
+        fprintf(out, "  %s: none\n", label);
+        return;
+    }
+    fprintf(out, "  %s: mean %.3f us, p50 %.3f us, p99 %.3f us, max %.3f us\n", label,
+            histogram->total_ns / 1e3 / histogram->count,
+            lock_histogram_percentile(histogram, 50) / 1e3,
+            lock_histogram_percentile(histogram, 99) / 1e3,
+            histogram->max_ns / 1e3);
+    for (bucket = 0; bucket < LOCK_HISTOGRAM_BUCKETS; bucket++) {
+        if (histogram->buckets[bucket] == 0)
+            continue;
+        if (bucket == LOCK_HISTOGRAM_BUCKETS - 1)
+            fprintf(out, "    >= %14llu ns: %llu\n", 1ULL << (bucket - 1),
+                    (unsigned long long)histogram->buckets[bucket]);
+        else
+            fprintf(out, "    <  %14llu ns: %llu\n", 1ULL << bucket,
+                    (unsigned long long)histogram->buckets[bucket]);
+    }
+}
+
+void lock_profile_report(const struct lock_profile *profile, FILE *out)
+{
+    fprintf(out, "%s: %llu acquisitions, %llu contended (%.1f%%)\n",
+            profile->name != NULL ? profile->name : "mutex",
+            (unsigned long long)profile->acquisitions,
+            (unsigned long long)profile->contended,
+            profile->acquisitions ? 100.0 * profile->contended / profile->acquisitions : 0.0);
+    lock_histogram_report("wait", &profile->wait, out);
+    lock_histogram_report("hold", &profile->hold, out);
+}
+
+/*
+ * Delayed lock tasks
+ *
+ * A task waits wait_to_obtain_ms, takes its mutex, holds it for
+ * wait_to_release_ms and releases it, like threadfunc(), but it is a few
+ * dozen bytes in a timer wheel instead of a thread sleeping in usleep().
+ *
+ * Timers live in a hierarchical wheel of WHEEL_LEVELS levels with
+ * WHEEL_SLOTS slots each and a 1 ms tick: level 0 holds timers due within
+ * 64 ms, level 1 within 4 s, and so on. Whenever a level wraps, the next
+ * level's current slot is cascaded down, so adding and expiring a timer is
+ * O(1) however many are pending. A timer thread advances the wheel and
+ * hands due tasks to a fixed pool of workers.
+ *
+ * Every task is bound to one worker, so the mutex is unlocked by the same
+ * thread that locked it. Tasks on the same mutex line up in its wait
+ * queue: only the task at the front, the owner, tries the mutex, and the
+ * worker releasing it passes it straight on to the next task in line.
+ * Workers never block on a task's mutex, so an owner finding it held by a
+ * thread outside the scheduler tries again on the next tick. Because the
+ * owner is tracked per mutex, a recursive mutex, whose trylock succeeds for
+ * a worker already holding it, is still only held by one task at a time.
+ */
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+// Furthest timer the wheel holds directly, later ones are cascaded again
+#define WHEEL_MAX_TICKS ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+#define WAITQ_BUCKETS 64
+
+enum lock_task_state {
+    LOCK_TASK_OBTAIN,
+    LOCK_TASK_RELEASE,
+};
+
+struct lock_task {
+    /*
+     * First, so join_task_obtaining_mutex() hands back a pointer the caller
+     * frees exactly as with a thread from start_thread_obtaining_mutex()
+     */
+    struct thread_data data;
+    enum lock_task_state state; // only touched by the task's worker
+    bool done;                  // protected by sched->lock
+    bool contended;             // a trylock has found the mutex busy
+    uint64_t wait_start_ns;     // when the task first tried the mutex
+    uint64_t expires;           // tick the task is due at
+    struct lock_task *next;     // wheel slot, run queue or wait queue link
+    struct lock_worker *worker;
+    struct lock_waitq *waitq;
+};
+
+// Tasks on one mutex, protected by sched->lock
+struct lock_waitq {
+    pthread_mutex_t *mutex;
+    struct lock_task *owner;    // task holding the mutex or next to take it
+    struct lock_task *head;     // tasks waiting behind the owner, FIFO
+    struct lock_task *tail;
+    size_t users;               // unfinished tasks on the mutex
+    struct lock_waitq *next;    // hash chain
+};
+
+struct lock_worker {
+    pthread_t thread;
+    pthread_cond_t wake;
+    struct lock_task *head;     // run queue, FIFO
+    struct lock_task *tail;
+    struct lock_scheduler *sched;
+};
+
+struct lock_scheduler {
+    pthread_mutex_t lock;       // protects everything below
+    pthread_cond_t timer_wake;
+    pthread_cond_t task_done;
+    pthread_t timer_thread;
+    struct timespec epoch;      // tick 0
+    uint64_t now;               // last tick the wheel was advanced to
+    size_t pending;             // tasks in the wheel
+    struct lock_task *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    struct lock_waitq *waitqs[WAITQ_BUCKETS];
+    bool running;
+    int nr_workers;
+    int next_worker;
+    struct lock_worker workers[];
+};
+
+static uint64_t scheduler_clock_tick(const struct lock_scheduler *sched)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - sched->epoch.tv_sec) * 1000 +
+           (ts.tv_nsec - sched->epoch.tv_nsec) / 1000000;
+}
+
+// Called with sched->lock held
+static void worker_enqueue(struct lock_task *task)
+{
+    struct lock_worker *worker = task->worker;
+
+    task->next = NULL;
+    if (worker->tail != NULL)
+        worker->tail->next = task;
+    else
+        worker->head = task;
+    worker->tail = task;
+    pthread_cond_signal(&worker->wake);
+}
+
+// Called with sched->lock held, files task under task->expires
+static void wheel_insert(struct lock_scheduler *sched, struct lock_task *task)
+{
+    uint64_t expires = task->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires <= sched->now) {
+        worker_enqueue(task);
+        return;
+    }
+    delta = expires - sched->now;
+    if (delta > WHEEL_MAX_TICKS)
+        expires = sched->now + WHEEL_MAX_TICKS;
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+            break;
+    }
+
+    struct lock_task **slot = &sched->wheel[level][(expires >> (WHEEL_BITS * level)) &
+                                                   (WHEEL_SLOTS - 1)];
+    task->next = *slot;
+    *slot = task;
+    sched->pending++;
+}
+
+// Called with sched->lock held, schedules the next step of task in delay ticks
+static void wheel_add(struct lock_scheduler *sched, struct lock_task *task, uint64_t delay)
+{
+    // An idle wheel stops following the clock, catch up before timing from it
+    if (sched->pending == 0)
+        sched->now = scheduler_clock_tick(sched);
+    // The current tick is partly over, count from the next so no wait is cut short
+    task->expires = sched->now + delay + (delay > 0);
+    wheel_insert(sched, task);
+    pthread_cond_signal(&sched->timer_wake);
+}
+
+// Called with sched->lock held, moves the wheel one tick forward
+static void wheel_advance(struct lock_scheduler *sched)
+{
+    struct lock_task *task, *next;
+    int level;
+
+    sched->now++;
+
+    // Refile the slot of each level that just came into range of the level below
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        uint64_t lower = sched->now >> (WHEEL_BITS * (level - 1));
+
+        if ((lower & (WHEEL_SLOTS - 1)) != 0)
+            break;
+        struct lock_task **slot = &sched->wheel[level][(lower >> WHEEL_BITS) &
+                                                       (WHEEL_SLOTS - 1)];
+        for (task = *slot, *slot = NULL; task != NULL; task = next) {
+            next = task->next;
+            sched->pending--;
+            wheel_insert(sched, task);
+        }
+    }
+
+    struct lock_task **slot = &sched->wheel[0][sched->now & (WHEEL_SLOTS - 1)];
+    for (task = *slot, *slot = NULL; task != NULL; task = next) {
+        next = task->next;
+        sched->pending--;
+        worker_enqueue(task);
+    }
+}
+
+static void *scheduler_timer_thread(void *arg)
+{
+    struct lock_scheduler *sched = arg;
+
+    pthread_mutex_lock(&sched->lock);
+    while (sched->running) {
+        uint64_t target = scheduler_clock_tick(sched);
+        struct timespec deadline;
+
+        while (sched->now < target && sched->pending > 0)
+            wheel_advance(sched);
+        if (sched->pending == 0) {
+            // Nothing to time, sleep until a task is added
+            sched->now = target;
+            pthread_cond_wait(&sched->timer_wake, &sched->lock);
+            continue;
+        }
+
+        // Sleep until the next tick starts
+        deadline = sched->epoch;
+        deadline.tv_sec += (sched->now + 1) / 1000;
+        deadline.tv_nsec += ((sched->now + 1) % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&sched->timer_wake, &sched->lock, &deadline);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return NULL;
+}
+
+static struct lock_waitq **waitq_bucket(struct lock_scheduler *sched, pthread_mutex_t *mutex)
+{
+    return &sched->waitqs[((uintptr_t)mutex / sizeof(pthread_mutex_t)) % WAITQ_BUCKETS];
+}
+
+/**
+ * Called with sched->lock held when @param task is due to obtain its mutex.
+ * @return true if the task owns the mutex and should try it, false if it
+ *   has been queued behind the owner
+ */
+static bool waitq_claim(struct lock_task *task)
+{
+    struct lock_waitq *waitq = task->waitq;
+
+    if (task->wait_start_ns == 0)
+        task->wait_start_ns = lock_profile_clock_ns();
+    if (waitq->owner == NULL)
+        waitq->owner = task;
+    if (waitq->owner == task)
+        return true;
+
+    task->contended = true;
+    task->next = NULL;
+    if (waitq->tail != NULL)
+        waitq->tail->next = task;
+    else
+        waitq->head = task;
+    waitq->tail = task;
     return false;
 }
 
+/*
+ * Called with sched->lock held once the owner @param task is done with its
+ * mutex. The next task in line becomes the owner and runs right away.
+ */
+static void waitq_pass(struct lock_scheduler *sched, struct lock_task *task)
+{
+    struct lock_waitq *waitq = task->waitq;
+    struct lock_waitq **link;
+
+    waitq->owner = waitq->head;
+    if (waitq->head != NULL) {
+        waitq->head = waitq->head->next;
+        if (waitq->head == NULL)
+            waitq->tail = NULL;
+        worker_enqueue(waitq->owner);
+    }
+
+    if (--waitq->users > 0)
+        return;
+    for (link = waitq_bucket(sched, waitq->mutex); *link != waitq; link = &(*link)->next)
+        ;
+    *link = waitq->next;
+    free(waitq);
+}
+
+/**
+ * Runs the next step of @param task, which owns its mutex, on its worker.
+ * @return the number of ticks until the next step, or -1 once the task is done
+ */
+static int64_t lock_task_step(struct lock_task *task)
+{
+    int rc;
+
+    switch (task->state) {
+    case LOCK_TASK_OBTAIN:
+        rc = pthread_mutex_trylock(task->data.mutex);
+        if (rc == EBUSY) {
+            // Held outside the scheduler, nobody will pass it on
+            task->contended = true;
+            return 1;
+        }
+        if (rc != 0) {
+            ERROR_LOG("Failed to lock mutex");
+            break;
+        }
+        lock_profile_acquired(&task->data.profile, task->wait_start_ns, task->contended);
+        task->state = LOCK_TASK_RELEASE;
+        return task->data.wait_to_release_ms;
+    case LOCK_TASK_RELEASE:
+        if (lock_profile_mutex_unlock(&task->data.profile, task->data.mutex) != 0) {
+            ERROR_LOG("Failed to unlock mutex");
+            break;
+        }
+        task->data.thread_complete_success = true;
+        break;
+    }
+    return -1;
+}
+
+static void *scheduler_worker_thread(void *arg)
+{
+    struct lock_worker *worker = arg;
+    struct lock_scheduler *sched = worker->sched;
+
+    pthread_mutex_lock(&sched->lock);
+    for (;;) {
+        struct lock_task *task = worker->head;
+        int64_t delay;
+
+        if (task == NULL) {
+            if (!sched->running)
+                break;
+            pthread_cond_wait(&worker->wake, &sched->lock);
+            continue;
+        }
+        worker->head = task->next;
+        if (worker->head == NULL)
+            worker->tail = NULL;
+
+        if (task->state == LOCK_TASK_OBTAIN && !waitq_claim(task))
+            continue;
+
+        pthread_mutex_unlock(&sched->lock);
+        do {
+            delay = lock_task_step(task);
+        } while (delay == 0);
+        pthread_mutex_lock(&sched->lock);
+
+        if (delay > 0) {
+            wheel_add(sched, task, delay);
+        } else {
+            waitq_pass(sched, task);
+            task->done = true;
+            pthread_cond_broadcast(&sched->task_done);
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return NULL;
+}
+
+/**
+* Creates a scheduler running delayed lock tasks on @param nr_workers threads
+* plus one timer thread.
+* @return the scheduler, or NULL if it could not be created
+*/
+struct lock_scheduler *lock_scheduler_create(int nr_workers)
+{
+    pthread_condattr_t attr;
+    struct lock_scheduler *sched;
+    int i;
+
+    if (nr_workers < 1)
+        return NULL;
+    sched = calloc(1, sizeof(*sched) + nr_workers * sizeof(sched->workers[0]));
+    if (sched == NULL) {
+        ERROR_LOG("Failed to allocate scheduler");
+        return NULL;
+    }
+    pthread_mutex_init(&sched->lock, NULL);
+    // Tick deadlines are CLOCK_MONOTONIC times, the timer must wait on that clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sched->timer_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&sched->task_done, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &sched->epoch);
+    sched->running = true;
+
+    if (pthread_create(&sched->timer_thread, NULL, scheduler_timer_thread, sched) != 0) {
+        ERROR_LOG("Failed to create timer thread");
+        goto fail;
+    }
+    for (i = 0; i < nr_workers; i++) {
+        sched->workers[i].sched = sched;
+        pthread_cond_init(&sched->workers[i].wake, NULL);
+        if (pthread_create(&sched->workers[i].thread, NULL, scheduler_worker_thread,
+                           &sched->workers[i]) != 0) {
+            ERROR_LOG("Failed to create worker thread");
+            pthread_cond_destroy(&sched->workers[i].wake);
+            break;
+        }
+        sched->nr_workers++;
+    }
+    if (sched->nr_workers == nr_workers)
+        return sched;
+
+    lock_scheduler_destroy(sched);
+    return NULL;
+
+fail:
+    pthread_cond_destroy(&sched->task_done);
+    pthread_cond_destroy(&sched->timer_wake);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched);
+    return NULL;
+}
+
+/**
+* Stops the threads of @param sched and frees it. Every task started on it
+* must have been joined.
+*/
+void lock_scheduler_destroy(struct lock_scheduler *sched)
+{
+    int i;
 
+    pthread_mutex_lock(&sched->lock);
+    sched->running = false;
+    pthread_cond_signal(&sched->timer_wake);
+    for (i = 0; i < sched->nr_workers; i++)
+        pthread_cond_signal(&sched->workers[i].wake);
+    pthread_mutex_unlock(&sched->lock);
+
+    pthread_join(sched->timer_thread, NULL);
+    for (i = 0; i < sched->nr_workers; i++) {
+        pthread_join(sched->workers[i].thread, NULL);
+        pthread_cond_destroy(&sched->workers[i].wake);
+    }
+    pthread_cond_destroy(&sched->task_done);
+    pthread_cond_destroy(&sched->timer_wake);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched);
+}
+
+bool start_task_obtaining_mutex(struct lock_scheduler *sched, struct lock_task **task,
+                                pthread_mutex_t *mutex, int wait_to_obtain_ms,
+                                int wait_to_release_ms)
+{
+    struct lock_waitq *spare;
+    struct lock_waitq **bucket;
+    struct lock_task *t;
+
+    if (wait_to_obtain_ms < 0 || wait_to_release_ms < 0)
+        return false;
+    t = calloc(1, sizeof(*t));
+    // The mutex may not have a wait queue yet, allocate one outside the lock
+    spare = calloc(1, sizeof(*spare));
+    if (t == NULL || spare == NULL) {
+        ERROR_LOG("Failed to allocate task");
+        free(spare);
+        free(t);
+        return false;
+    }
+    t->data.mutex = mutex;
+    t->data.wait_to_obtain_ms = wait_to_obtain_ms;
+    t->data.wait_to_release_ms = wait_to_release_ms;
+    t->data.thread_complete_success = false;
+    lock_profile_init(&t->data.profile, NULL);
+    t->state = LOCK_TASK_OBTAIN;
+
+    pthread_mutex_lock(&sched->lock);
+    bucket = waitq_bucket(sched, mutex);
+    for (t->waitq = *bucket; t->waitq != NULL; t->waitq = t->waitq->next) {
+        if (t->waitq->mutex == mutex)
+            break;
+    }
+    if (t->waitq == NULL) {
+        t->waitq = spare;
+        spare = NULL;
+        t->waitq->mutex = mutex;
+        t->waitq->next = *bucket;
+        *bucket = t->waitq;
+    }
+    t->waitq->users++;
+    t->worker = &sched->workers[sched->next_worker];
+    sched->next_worker = (sched->next_worker + 1) % sched->nr_workers;
+    wheel_add(sched, t, wait_to_obtain_ms);
+    pthread_mutex_unlock(&sched->lock);
+    free(spare);
+
+    *task = t;
+    return true;
+}
+
+struct thread_data *join_task_obtaining_mutex(struct lock_scheduler *sched,
+                                              struct lock_task *task)
+{
+    pthread_mutex_lock(&sched->lock);
+    while (!task->done)
+        pthread_cond_wait(&sched->task_done, &sched->lock);
+    pthread_mutex_unlock(&sched->lock);
+    return &task->data;
+}
@@ -1,6 +1,35 @@
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <pthread.h>
 
+/**
+ * Number of histogram buckets. Bucket 0 counts zero-length intervals and bucket i
+ * counts intervals of 2^(i-1) to 2^i - 1 nanoseconds, the last bucket everything longer.
+ */
+#define LOCK_HISTOGRAM_BUCKETS 40
+
+struct lock_histogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LOCK_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Contention statistics for one mutex as seen by one thread. Each thread records into
+ * its own lock_profile without synchronisation, and the profiles are combined with
+ * lock_profile_merge once the threads have been joined.
+ */
+struct lock_profile {
+    const char *name;           // reported by lock_profile_report, may be NULL
+    uint64_t acquisitions;
+    uint64_t contended;         // acquisitions which found the mutex already locked
+    struct lock_histogram wait; // time from asking for the mutex to obtaining it
+    struct lock_histogram hold; // time from obtaining the mutex to releasing it
+    uint64_t locked_at_ns;      // when the current acquisition obtained the mutex
+};
+
 /**
  * This structure should be dynamically allocated and passed as
  * an argument to your thread using pthread_create.
@@ -24,6 +53,11 @@ struct thread_data{
      * if an error occurred.
      */
     bool thread_complete_success;
+
+    /**
+     * Wait and hold times of the mutex, filled in by the thread.
+     */
+    struct lock_profile profile;
 };
 
 
@@ -42,3 +76,90 @@ struct thread_data{
 * @return true if the thread could be started, false if a failure occurred.
 */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms);
+
+/**
+* Join @param thread started by start_thread_obtaining_mutex, add its lock profile to @param profile
+* if that is not NULL, and free its thread_data.
+* @return true if the thread completed with success, false otherwise.
+*/
+bool join_thread_obtaining_mutex(pthread_t thread, struct lock_profile *profile);
+
+/**
+* Reset @param profile, labelling it @param name in reports.
+*/
+void lock_profile_init(struct lock_profile *profile, const char *name);
+
+/**
+* Lock @param mutex as pthread_mutex_lock does, recording the wait in @param profile and counting
+* the acquisition as contended if the mutex was already locked.
+* @return the pthread_mutex_lock result.
+*/
+int lock_profile_mutex_lock(struct lock_profile *profile, pthread_mutex_t *mutex);
+
+/**
+* Unlock @param mutex as pthread_mutex_unlock does, recording in @param profile how long it was held
+* since lock_profile_mutex_lock. A profile can only time one held acquisition at a time.
+* @return the pthread_mutex_unlock result.
+*/
+int lock_profile_mutex_unlock(struct lock_profile *profile, pthread_mutex_t *mutex);
+
+/**
+* Add the counts and histograms of @param from to @param into.
+*/
+void lock_profile_merge(struct lock_profile *into, const struct lock_profile *from);
+
+/**
+* @return an upper bound in nanoseconds on the @param percentile (0 to 100) interval in
+* @param histogram, or 0 if it is empty.
+*/
+uint64_t lock_histogram_percentile(const struct lock_histogram *histogram, double percentile);
+
+/**
+* Write acquisition and contention counts, wait and hold time percentiles and the non-empty
+* histogram buckets of @param profile to @param out.
+*/
+void lock_profile_report(const struct lock_profile *profile, FILE *out);
+
+/**
+ * Scheduler running delayed mutex tasks from a timer wheel on a fixed pool of
+ * worker threads, for when a thread per start_thread_obtaining_mutex() call
+ * would be too many threads.
+ */
+struct lock_scheduler;
+struct lock_task;
+
+/**
+* Create a scheduler with @param nr_workers worker threads and one timer thread.
+* @return the scheduler, or NULL if @param nr_workers is less than 1 or a failure occurred.
+*/
+struct lock_scheduler *lock_scheduler_create(int nr_workers);
+
+/**
+* Stop the threads of @param sched and free it. Every task started on @param sched must
+* have been joined with join_task_obtaining_mutex first.
+*/
+void lock_scheduler_destroy(struct lock_scheduler *sched);
+
+/**
+* Schedule a task on @param sched which waits @param wait_to_obtain_ms milliseconds, then obtains
+* the mutex in @param mutex, then holds it for @param wait_to_release_ms milliseconds, then releases
+* it, as the thread started by start_thread_obtaining_mutex does. The task does not occupy a thread
+* while waiting: a worker thread runs it when it is due. Tasks on the same mutex take it in the
+* order they became due, each one as soon as the previous task releases it; a mutex held by a
+* thread outside the scheduler is retried every millisecond. The mutex is unlocked on the worker
+* thread which locked it.
+* If the task was started successfully @param task is filled with a handle for
+* join_task_obtaining_mutex.
+* @return true if the task could be started, false if a failure occurred.
+*/
+bool start_task_obtaining_mutex(struct lock_scheduler *sched, struct lock_task **task,
+                                pthread_mutex_t *mutex, int wait_to_obtain_ms,
+                                int wait_to_release_ms);
+
+/**
+* Wait for @param task started on @param sched to complete.
+* @return the task's thread_data, to check thread_complete_success and then free as with a thread
+* started by start_thread_obtaining_mutex.
+*/
+struct thread_data *join_task_obtaining_mutex(struct lock_scheduler *sched,
+                                              struct lock_task *task);
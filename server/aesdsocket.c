@@ -7,10 +7,12 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <syslog.h>
@@ -38,10 +40,33 @@ static volatile sig_atomic_t shutdown_requested = 0;
 static int g_server_fd = -1;
 static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Build switch: set AESDSOCKET_LOCK_PROFILE=1 (make LOCK_PROFILE=1) to time
+ * file_mutex with the threading module's lock profiler. Each thread records
+ * into its own profile, which is merged into file_mutex_profile when the
+ * thread is joined and logged at exit.
+ */
+#ifndef AESDSOCKET_LOCK_PROFILE
+#define AESDSOCKET_LOCK_PROFILE 0
+#endif
+
+#if AESDSOCKET_LOCK_PROFILE
+#include "../examples/threading/threading.h"
+static struct lock_profile file_mutex_profile = { .name = "file_mutex" };
+#define FILE_LOCK(profile)   lock_profile_mutex_lock(profile, &file_mutex)
+#define FILE_UNLOCK(profile) lock_profile_mutex_unlock(profile, &file_mutex)
+#else
+#define FILE_LOCK(profile)   pthread_mutex_lock(&file_mutex)
+#define FILE_UNLOCK(profile) pthread_mutex_unlock(&file_mutex)
+#endif
+
 typedef struct thread_node {
     pthread_t thread;
     int client_fd;
     bool thread_complete;
+#if AESDSOCKET_LOCK_PROFILE
+    struct lock_profile profile;
+#endif
     SLIST_ENTRY(thread_node) entries;
 } thread_node_t;
 
@@ -51,6 +76,9 @@ SLIST_HEAD(thread_list_head, thread_node) g_thread_head =
 #if !USE_AESD_CHAR_DEVICE
 static pthread_t timestamp_thread;
 static bool timestamp_thread_started = false;
+#if AESDSOCKET_LOCK_PROFILE
+static struct lock_profile timestamp_profile;
+#endif
 #endif
 
 static void signal_handler(int signo)
@@ -124,6 +152,31 @@ static int send_all(int sockfd, const char *buf, size_t len)
     return 0;
 }
 
+/*
+ * Send everything from the current offset of data_fd to the socket.
+ * sendfile() lets the kernel splice the data straight into the socket;
+ * fall back to read()/send() through buf if data_fd cannot be spliced.
+ * Returns 0 on success, -1 with errno set on a send or read failure.
+ */
+static int send_fd_contents(int sockfd, int data_fd, char *buf, size_t buflen)
+{
+    bool sent_any = false;
+    ssize_t n;
+
+    while ((n = sendfile(sockfd, data_fd, NULL, buflen)) > 0)
+        sent_any = true;
+    if (n == 0)
+        return 0;
+    if (sent_any || (errno != EINVAL && errno != ENOSYS))
+        return -1;
+
+    while ((n = read(data_fd, buf, buflen)) > 0) {
+        if (send_all(sockfd, buf, (size_t)n) != 0)
+            return -1;
+    }
+    return n < 0 ? -1 : 0;
+}
+
 #if !USE_AESD_CHAR_DEVICE
 static void *timestamp_thread_func(void *arg)
 {
@@ -141,7 +194,7 @@ static void *timestamp_thread_func(void *arg)
         char line[256];
         int len = snprintf(line, sizeof(line), "timestamp:%s\n", timebuf);
         if (len <= 0) continue;
-        pthread_mutex_lock(&file_mutex);
+        FILE_LOCK(&timestamp_profile);
         int fd = open(DATA_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
         if (fd >= 0) {
             ssize_t off = 0;
@@ -152,7 +205,7 @@ static void *timestamp_thread_func(void *arg)
             }
             close(fd);
         }
-        pthread_mutex_unlock(&file_mutex);
+        FILE_UNLOCK(&timestamp_profile);
     }
     return NULL;
 }
@@ -195,7 +248,7 @@ static void *client_thread_func(void *arg)
             if (!nlptr) break;
             size_t pkt_len = ((char *)nlptr - acc) + 1;
 
-            pthread_mutex_lock(&file_mutex);
+            FILE_LOCK(&node->profile);
 
 #if USE_AESD_CHAR_DEVICE
             /* Check for AESDCHAR_IOCSEEKTO:X,Y command */
@@ -213,30 +266,44 @@ static void *client_thread_func(void *arg)
                     if (data_fd < 0) {
                         syslog(LOG_ERR, "open data file failed: %s", strerror(errno));
                         free(pkt_copy);
-                        pthread_mutex_unlock(&file_mutex);
+                        FILE_UNLOCK(&node->profile);
                         goto out;
                     }
-                    if (ioctl(data_fd, AESDCHAR_IOCSEEKTO, &seekto) != 0) {
-                        syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKTO failed: %s", strerror(errno));
-                    }
-                    /* Read from the seeked position and send back — same fd */
-                    ssize_t bytes_read;
-                    while ((bytes_read = read(data_fd, buffer, sizeof(buffer))) > 0) {
-                        if (send_all(client_fd, buffer, (size_t)bytes_read) != 0) {
+                    /* Seek and fetch the first chunk in one call */
+                    struct aesd_readrange range = {
+                        .write_cmd        = seekto.write_cmd,
+                        .write_cmd_offset = seekto.write_cmd_offset,
+                        .buf              = (uint64_t)(uintptr_t)buffer,
+                        .len              = sizeof(buffer),
+                    };
+                    bool more = false;
+                    if (ioctl(data_fd, AESDCHAR_IOCREADRANGE, &range) == 0) {
+                        if (range.bytes_read > 0 &&
+                            send_all(client_fd, buffer, (size_t)range.bytes_read) != 0) {
                             syslog(LOG_ERR, "send failed: %s", strerror(errno));
-                            break;
+                        } else {
+                            more = range.bytes_read == sizeof(buffer);
+                        }
+                    } else {
+                        /* Older driver without READRANGE, fall back to SEEKTO + read */
+                        if (ioctl(data_fd, AESDCHAR_IOCSEEKTO, &seekto) != 0) {
+                            syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKTO failed: %s", strerror(errno));
                         }
+                        more = true;
                     }
+                    /* Send anything past the first chunk from the same fd */
+                    if (more && send_fd_contents(client_fd, data_fd, buffer, sizeof(buffer)) != 0)
+                        syslog(LOG_ERR, "send failed: %s", strerror(errno));
                     close(data_fd);
                 }
                 free(pkt_copy);
-                pthread_mutex_unlock(&file_mutex);
+                FILE_UNLOCK(&node->profile);
             } else {
                 /* Normal path: write to device, then read all and send back */
                 int data_fd = open(DATA_FILE, O_RDWR);
                 if (data_fd < 0) {
                     syslog(LOG_ERR, "open data file failed: %s", strerror(errno));
-                    pthread_mutex_unlock(&file_mutex);
+                    FILE_UNLOCK(&node->profile);
                     goto out;
                 }
                 ssize_t off = 0;
@@ -253,26 +320,19 @@ static void *client_thread_func(void *arg)
                 data_fd = open(DATA_FILE, O_RDONLY);
                 if (data_fd < 0) {
                     syslog(LOG_ERR, "open data file for read failed: %s", strerror(errno));
-                    pthread_mutex_unlock(&file_mutex);
+                    FILE_UNLOCK(&node->profile);
                     goto out;
                 }
-                ssize_t bytes_read;
-                while ((bytes_read = read(data_fd, buffer, sizeof(buffer))) > 0) {
-                    if (send_all(client_fd, buffer, (size_t)bytes_read) != 0) {
-                        syslog(LOG_ERR, "send failed: %s", strerror(errno));
-                        break;
-                    }
-                }
-                if (bytes_read < 0)
-                    syslog(LOG_ERR, "read failed: %s", strerror(errno));
+                if (send_fd_contents(client_fd, data_fd, buffer, sizeof(buffer)) != 0)
+                    syslog(LOG_ERR, "send failed: %s", strerror(errno));
                 close(data_fd);
-                pthread_mutex_unlock(&file_mutex);
+                FILE_UNLOCK(&node->profile);
             }
 #else
             int data_fd = open(DATA_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
             if (data_fd < 0) {
                 syslog(LOG_ERR, "open data file failed: %s", strerror(errno));
-                pthread_mutex_unlock(&file_mutex);
+                FILE_UNLOCK(&node->profile);
                 goto out;
             }
             ssize_t off = 0;
@@ -289,20 +349,13 @@ static void *client_thread_func(void *arg)
             data_fd = open(DATA_FILE, O_RDONLY);
             if (data_fd < 0) {
                 syslog(LOG_ERR, "open data file for read failed: %s", strerror(errno));
-                pthread_mutex_unlock(&file_mutex);
+                FILE_UNLOCK(&node->profile);
                 goto out;
             }
-            ssize_t bytes_read;
-            while ((bytes_read = read(data_fd, buffer, sizeof(buffer))) > 0) {
-                if (send_all(client_fd, buffer, (size_t)bytes_read) != 0) {
-                    syslog(LOG_ERR, "send failed: %s", strerror(errno));
-                    break;
-                }
-            }
-            if (bytes_read < 0)
-                syslog(LOG_ERR, "read failed: %s", strerror(errno));
+            if (send_fd_contents(client_fd, data_fd, buffer, sizeof(buffer)) != 0)
+                syslog(LOG_ERR, "send failed: %s", strerror(errno));
             close(data_fd);
-            pthread_mutex_unlock(&file_mutex);
+            FILE_UNLOCK(&node->profile);
 #endif
 
             size_t remaining = acc_len - pkt_len;
@@ -328,6 +381,27 @@ out:
     return node;
 }
 
+#if AESDSOCKET_LOCK_PROFILE
+/* Logs the merged file_mutex profile, one syslog message per report line */
+static void report_lock_profile(void)
+{
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *out = open_memstream(&report, &report_len);
+
+    if (!out) {
+        syslog(LOG_ERR, "open_memstream failed: %s", strerror(errno));
+        return;
+    }
+    lock_profile_report(&file_mutex_profile, out);
+    fclose(out);
+    for (char *save = NULL, *line = strtok_r(report, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save))
+        syslog(LOG_INFO, "%s", line);
+    free(report);
+}
+#endif
+
 static void cleanup_and_exit(void)
 {
     syslog(LOG_INFO, "Caught signal, exiting");
@@ -342,15 +416,24 @@ static void cleanup_and_exit(void)
             n->client_fd = -1;
         }
         pthread_join(n->thread, NULL);
+#if AESDSOCKET_LOCK_PROFILE
+        lock_profile_merge(&file_mutex_profile, &n->profile);
+#endif
         free(n);
     }
 
 #if !USE_AESD_CHAR_DEVICE
     if (timestamp_thread_started) {
         pthread_join(timestamp_thread, NULL);
+#if AESDSOCKET_LOCK_PROFILE
+        lock_profile_merge(&file_mutex_profile, &timestamp_profile);
+#endif
     }
 #endif
 
+#if AESDSOCKET_LOCK_PROFILE
+    report_lock_profile();
+#endif
     pthread_mutex_destroy(&file_mutex);
 
     if (g_server_fd != -1) {
@@ -473,6 +556,9 @@ int main(int argc, char *argv[])
             thread_node_t *next = SLIST_NEXT(cur, entries);
             if (cur->thread_complete) {
                 pthread_join(cur->thread, NULL);
+#if AESDSOCKET_LOCK_PROFILE
+                lock_profile_merge(&file_mutex_profile, &cur->profile);
+#endif
                 if (prev == NULL) {
                     SLIST_REMOVE_HEAD(&g_thread_head, entries);
                 } else {
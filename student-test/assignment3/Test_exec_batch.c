@@ -0,0 +1,62 @@
+#include "unity.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+void test_exec_batch_spawn_errors()
+{
+    static char *const ok[] = { "/bin/true", NULL };
+    static char *const missing[] = { "/nonexistent/command", NULL };
+    static char *const fails[] = { "/bin/false", NULL };
+    static char *const exits[] = { "/bin/sh", "-c", "exit 3", NULL };
+    static char *const *const commands[] = { ok, missing, fails, exits, ok };
+    struct exec_batch_result results[5];
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(commands, 5, 2, results),
+                              "A batch with a command that cannot start must fail");
+
+    // A command that could not be started does not stop the others
+    TEST_ASSERT_EQUAL_INT(0, results[0].error);
+    TEST_ASSERT_TRUE(results[0].success);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(ENOENT, results[1].error,
+                                  "The spawn error should be reported for the missing command");
+    TEST_ASSERT_FALSE(results[1].success);
+    TEST_ASSERT_EQUAL_INT(0, results[2].error);
+    TEST_ASSERT_TRUE(WIFEXITED(results[2].status) && WEXITSTATUS(results[2].status) == 1);
+    TEST_ASSERT_FALSE(results[2].success);
+    TEST_ASSERT_EQUAL_INT(0, results[3].error);
+    TEST_ASSERT_TRUE(WIFEXITED(results[3].status) && WEXITSTATUS(results[3].status) == 3);
+    TEST_ASSERT_FALSE(results[3].success);
+    TEST_ASSERT_EQUAL_INT(0, results[4].error);
+    TEST_ASSERT_TRUE(results[4].success);
+}
+
+void test_exec_batch_parallelism()
+{
+    static char *const nap[] = { "/bin/sh", "-c", "sleep 0.2", NULL };
+    static char *const *const commands[] = { nap, nap, nap, nap };
+    struct exec_batch_result results[4];
+    struct timespec start, end;
+    uint64_t elapsed_ns;
+    size_t i;
+
+    // At most two at once: two rounds, not one and not four
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_TRUE(do_exec_batch(commands, 4, 2, results));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ns = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT64_MESSAGE(400000000ull, elapsed_ns,
+                                                "More than two commands ran at once");
+    TEST_ASSERT_LESS_THAN_UINT64_MESSAGE(800000000ull, elapsed_ns,
+                                         "Commands did not run in parallel");
+    for (i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(results[i].success);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64_MESSAGE(200000000ull, results[i].wall_ns,
+                                                    "wall_ns should cover the whole command");
+    }
+
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_batch(commands, 0, 0, results),
+                             "An empty batch trivially succeeds");
+}
@@ -0,0 +1,109 @@
+#include "unity.h"
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+static uint64_t elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000ull + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void test_exec_capture_both_streams()
+{
+    struct exec_capture capture;
+
+    memset(&capture, 0, sizeof(capture));
+    TEST_ASSERT_TRUE(do_exec_capture(&capture, 3, "/bin/sh", "-c",
+                                     "printf out; printf err >&2"));
+    TEST_ASSERT_EQUAL_STRING("out", capture.out.data);
+    TEST_ASSERT_EQUAL_INT(3, capture.out.len);
+    TEST_ASSERT_FALSE(capture.out.truncated);
+    TEST_ASSERT_EQUAL_STRING("err", capture.err.data);
+    TEST_ASSERT_FALSE(capture.timed_out);
+    free(capture.out.data);
+    free(capture.err.data);
+}
+
+void test_exec_capture_truncated_at_capacity()
+{
+    struct exec_capture capture;
+    char out[8];
+    char empty[1] = { 'x' };
+
+    memset(&capture, 0, sizeof(capture));
+    capture.out.data = out;
+    capture.out.capacity = sizeof(out);
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "printf 0123456789"),
+                             "Truncation alone must not fail the command");
+    // One byte is kept for the terminating NUL
+    TEST_ASSERT_EQUAL_STRING("0123456", out);
+    TEST_ASSERT_EQUAL_INT(7, capture.out.len);
+    TEST_ASSERT_TRUE(capture.out.truncated);
+    free(capture.err.data);
+
+    // A caller buffer without room for the NUL is left alone
+    memset(&capture, 0, sizeof(capture));
+    capture.out.data = empty;
+    capture.out.capacity = 0;
+    TEST_ASSERT_TRUE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "printf abc"));
+    TEST_ASSERT_EQUAL_INT(0, capture.out.len);
+    TEST_ASSERT_TRUE(capture.out.truncated);
+    TEST_ASSERT_EQUAL_INT('x', empty[0]);
+    free(capture.err.data);
+}
+
+void test_exec_capture_truncated_at_max_bytes()
+{
+    struct exec_capture capture;
+
+    // The rest of the output is drained, so the writer finishes normally
+    memset(&capture, 0, sizeof(capture));
+    capture.max_bytes = 5;
+    TEST_ASSERT_TRUE(do_exec_capture(&capture, 3, "/bin/sh", "-c",
+                                     "yes | head -c 1000000; yes | head -c 1000000 >&2"));
+    TEST_ASSERT_EQUAL_STRING("y\ny\ny", capture.out.data);
+    TEST_ASSERT_EQUAL_INT(5, capture.out.len);
+    TEST_ASSERT_TRUE(capture.out.truncated);
+    TEST_ASSERT_EQUAL_INT(5, capture.err.len);
+    TEST_ASSERT_TRUE(capture.err.truncated);
+    free(capture.out.data);
+    free(capture.err.data);
+}
+
+void test_exec_capture_timeout_kill()
+{
+    struct exec_capture capture;
+    struct timespec start;
+
+    memset(&capture, 0, sizeof(capture));
+    capture.timeout_ms = 200;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_FALSE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "printf partial; exec sleep 10"));
+    TEST_ASSERT_LESS_THAN_UINT64_MESSAGE(5000, elapsed_ms(&start),
+                                         "The command should be killed at the timeout");
+    TEST_ASSERT_TRUE(capture.timed_out);
+    TEST_ASSERT_TRUE(WIFSIGNALED(capture.status) && WTERMSIG(capture.status) == SIGKILL);
+    TEST_ASSERT_EQUAL_STRING("partial", capture.out.data);
+    free(capture.out.data);
+    free(capture.err.data);
+
+    // Closing both pipes does not escape the timeout
+    memset(&capture, 0, sizeof(capture));
+    capture.timeout_ms = 200;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_FALSE(do_exec_capture(&capture, 3, "/bin/sh", "-c",
+                                      "exec >&- 2>&-; exec sleep 10"));
+    TEST_ASSERT_LESS_THAN_UINT64_MESSAGE(5000, elapsed_ms(&start),
+                                         "The timeout should cover a child that closed its pipes");
+    TEST_ASSERT_TRUE(capture.timed_out);
+    TEST_ASSERT_TRUE(WIFSIGNALED(capture.status) && WTERMSIG(capture.status) == SIGKILL);
+    free(capture.out.data);
+    free(capture.err.data);
+}
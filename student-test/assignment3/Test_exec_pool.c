@@ -0,0 +1,86 @@
+#include "unity.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+#define POOL_THREADS 4
+#define POOL_RUNS_PER_THREAD 10
+
+static void *run_pool_commands(void *arg)
+{
+    struct exec_pool *pool = arg;
+    int i;
+
+    for (i = 0; i < POOL_RUNS_PER_THREAD; i++) {
+        if (!do_exec_pool(pool, 1, "/bin/true"))
+            return (void *)1;
+    }
+    return NULL;
+}
+
+void test_exec_pool_round_trip()
+{
+    char path[] = "/tmp/Test_exec_pool_XXXXXX";
+    char script[128];
+    char contents[16] = { 0 };
+    struct exec_pool *pool;
+    FILE *file;
+    int fd;
+
+    fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    pool = exec_pool_create(2);
+    TEST_ASSERT_NOT_NULL(pool);
+
+    // The command really runs, with its arguments intact
+    snprintf(script, sizeof(script), "printf '%%s' \"$1\" > %s", path);
+    TEST_ASSERT_TRUE(do_exec_pool(pool, 5, "/bin/sh", "-c", script, "sh", "a b"));
+    file = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_NOT_NULL(fgets(contents, sizeof(contents), file));
+    fclose(file);
+    unlink(path);
+    TEST_ASSERT_EQUAL_STRING("a b", contents);
+
+    // Failures are reported and leave the helpers usable
+    TEST_ASSERT_FALSE(do_exec_pool(pool, 3, "/bin/sh", "-c", "exit 1"));
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_pool(pool, 1, "/nonexistent/command"),
+                              "A command that cannot start must fail");
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_pool(pool, 1, "echo"),
+                              "Commands need a full path, as with do_exec()");
+    TEST_ASSERT_TRUE(do_exec_pool(pool, 1, "/bin/true"));
+
+    exec_pool_destroy(pool);
+}
+
+void test_exec_pool_threads()
+{
+    pthread_t threads[POOL_THREADS];
+    struct exec_pool *pool;
+    void *result;
+    int i;
+
+    // More callers than helpers, so some wait for an idle helper
+    pool = exec_pool_create(2);
+    TEST_ASSERT_NOT_NULL(pool);
+    for (i = 0; i < POOL_THREADS; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, run_pool_commands, pool));
+    for (i = 0; i < POOL_THREADS; i++) {
+        pthread_join(threads[i], &result);
+        TEST_ASSERT_NULL_MESSAGE(result, "A command run through the pool failed");
+    }
+    exec_pool_destroy(pool);
+}
+
+void test_exec_pool_no_helpers()
+{
+    errno = 0;
+    TEST_ASSERT_NULL(exec_pool_create(0));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+}
@@ -0,0 +1,80 @@
+#include "unity.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+struct hook_calls {
+    int count;
+    int signal[4];
+    char last_command[32];
+};
+
+static void record_stats(const char *const command[], const struct exec_stats *stats, void *arg)
+{
+    struct hook_calls *calls = arg;
+
+    if (calls->count < 4)
+        calls->signal[calls->count] = stats->signal;
+    calls->count++;
+    strncpy(calls->last_command, command[0], sizeof(calls->last_command) - 1);
+}
+
+void test_exec_stats_signalled_child()
+{
+    struct exec_stats stats;
+
+    TEST_ASSERT_FALSE(do_exec_stats(&stats, 3, "/bin/sh", "-c", "kill -TERM $$"));
+    TEST_ASSERT_EQUAL_INT(0, stats.error);
+    TEST_ASSERT_TRUE(stats.signaled);
+    TEST_ASSERT_EQUAL_INT(SIGTERM, stats.signal);
+    TEST_ASSERT_FALSE(stats.exited);
+    TEST_ASSERT_EQUAL_INT(0, stats.exit_code);
+    TEST_ASSERT_TRUE_MESSAGE(stats.max_rss_kb > 0, "rusage of the child should be filled in");
+}
+
+void test_exec_stats_exit_code()
+{
+    struct exec_stats stats;
+
+    TEST_ASSERT_FALSE(do_exec_stats(&stats, 3, "/bin/sh", "-c", "exit 7"));
+    TEST_ASSERT_EQUAL_INT(0, stats.error);
+    TEST_ASSERT_TRUE(stats.exited);
+    TEST_ASSERT_EQUAL_INT(7, stats.exit_code);
+    TEST_ASSERT_FALSE(stats.signaled);
+    TEST_ASSERT_EQUAL_INT(0, stats.signal);
+
+    TEST_ASSERT_TRUE(do_exec_stats(&stats, 3, "/bin/sh", "-c", "sleep 0.1"));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT64_MESSAGE(100000000ull, stats.run_ns,
+                                                "run_ns should cover the whole command");
+}
+
+void test_exec_stats_spawn_error()
+{
+    struct exec_stats stats;
+
+    TEST_ASSERT_FALSE(do_exec_stats(&stats, 1, "/nonexistent/command"));
+    TEST_ASSERT_EQUAL_INT(ENOENT, stats.error);
+    TEST_ASSERT_FALSE(stats.exited);
+    TEST_ASSERT_FALSE(stats.signaled);
+    TEST_ASSERT_EQUAL_UINT64(0, stats.run_ns);
+}
+
+void test_exec_stats_hook()
+{
+    struct hook_calls calls;
+
+    memset(&calls, 0, sizeof(calls));
+    exec_set_stats_hook(record_stats, &calls);
+    // Plain do_exec() reports through the hook as well
+    TEST_ASSERT_FALSE(do_exec(3, "/bin/sh", "-c", "kill -KILL $$"));
+    TEST_ASSERT_TRUE(do_exec_redirect("/dev/null", 1, "/bin/true"));
+    exec_set_stats_hook(NULL, NULL);
+    TEST_ASSERT_TRUE(do_exec(1, "/bin/true"));
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, calls.count, "The hook should run once per command until removed");
+    TEST_ASSERT_EQUAL_INT(SIGKILL, calls.signal[0]);
+    TEST_ASSERT_EQUAL_INT(0, calls.signal[1]);
+    TEST_ASSERT_EQUAL_STRING("/bin/true", calls.last_command);
+}
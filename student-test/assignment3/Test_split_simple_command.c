@@ -0,0 +1,128 @@
+#include "unity.h"
+#include <stdlib.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+/**
+* Each command either splits into the listed words, or needs /bin/sh and
+* makes split_simple_command() return NULL so do_system() falls back to system().
+*/
+struct split_case {
+    const char *cmd;
+    /**
+     * Expected words, NULL terminated; NULL first means a shell is needed
+     */
+    const char *words[5];
+};
+
+static void check_split_cases(const struct split_case *cases, size_t count)
+{
+    size_t i, j;
+
+    for (i = 0; i < count; i++) {
+        char **argv = split_simple_command(cases[i].cmd);
+
+        if (cases[i].words[0] == NULL) {
+            TEST_ASSERT_NULL_MESSAGE(argv, cases[i].cmd);
+            continue;
+        }
+        TEST_ASSERT_NOT_NULL_MESSAGE(argv, cases[i].cmd);
+        for (j = 0; cases[i].words[j] != NULL; j++)
+            TEST_ASSERT_EQUAL_STRING_MESSAGE(cases[i].words[j], argv[j], cases[i].cmd);
+        TEST_ASSERT_NULL_MESSAGE(argv[j], cases[i].cmd);
+        free(argv);
+    }
+}
+
+void test_split_simple_command_plain_words()
+{
+    static const struct split_case cases[] = {
+        { "/bin/true", { "/bin/true" } },
+        { "/bin/echo hello world", { "/bin/echo", "hello", "world" } },
+        { "  ls\t-l   /tmp  ", { "ls", "-l", "/tmp" } },
+        { "touch a.b-c_d/e:f,g@h%i+j", { "touch", "a.b-c_d/e:f,g@h%i+j" } },
+    };
+
+    check_split_cases(cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+void test_split_simple_command_quoting()
+{
+    static const struct split_case cases[] = {
+        { "cat 'a b'", { "cat", "a b" } },
+        { "cat \"a b\"", { "cat", "a b" } },
+        { "cat a'b c'd\" e\"", { "cat", "ab cd e" } },
+        { "cat '' \"\"", { "cat", "", "" } },
+        // Single quotes keep everything literal, double quotes only plain text
+        { "grep '$HOME|*;\\' f", { "grep", "$HOME|*;\\", "f" } },
+        { "grep \"a'b\" f", { "grep", "a'b", "f" } },
+        { "cat 'unterminated", { NULL } },
+        { "cat \"unterminated", { NULL } },
+        { "cat \"$HOME\"", { NULL } },
+        { "cat \"`pwd`\"", { NULL } },
+        { "cat \"a!b\"", { NULL } },
+    };
+
+    check_split_cases(cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+void test_split_simple_command_backslash()
+{
+    static const struct split_case cases[] = {
+        { "cat a\\ b", { NULL } },
+        { "cat \\$HOME", { NULL } },
+        { "cat \"a\\\"b\"", { NULL } },
+        { "cat a\\", { NULL } },
+    };
+
+    check_split_cases(cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+void test_split_simple_command_shell_syntax()
+{
+    static const struct split_case cases[] = {
+        { "ls | wc -l", { NULL } },
+        { "ls && ls", { NULL } },
+        { "ls &", { NULL } },
+        { "ls; ls", { NULL } },
+        { "ls > out", { NULL } },
+        { "cat < in", { NULL } },
+        { "(ls)", { NULL } },
+        { "ls $HOME", { NULL } },
+        { "ls `pwd`", { NULL } },
+        { "ls *.c", { NULL } },
+        { "ls ?", { NULL } },
+        { "ls [ab]", { NULL } },
+        { "ls {a,b}", { NULL } },
+        { "ls ~", { NULL } },
+        { "ls # comment", { NULL } },
+        { "VAR=1 ls", { NULL } },
+        { "ls\nls", { NULL } },
+        { "! ls", { NULL } },
+    };
+
+    check_split_cases(cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+void test_split_simple_command_shell_words()
+{
+    static const struct split_case cases[] = {
+        { "cd /tmp", { NULL } },
+        { "echo hello", { NULL } },
+        { "exit 1", { NULL } },
+        { "if true", { NULL } },
+        // Only the first word is looked up
+        { "/bin/echo cd exit", { "/bin/echo", "cd", "exit" } },
+    };
+
+    check_split_cases(cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+void test_split_simple_command_empty()
+{
+    static const struct split_case cases[] = {
+        { "", { NULL } },
+        { "   \t ", { NULL } },
+    };
+
+    check_split_cases(cases, sizeof(cases) / sizeof(cases[0]));
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "unity.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../examples/threading/threading.h"
+
+#define CONTENDERS 3
+
+// Bucket holding intervals of @param ms milliseconds, see LOCK_HISTOGRAM_BUCKETS
+static int bucket_of_ms(uint64_t ms)
+{
+    return 64 - __builtin_clzll(ms * 1000000);
+}
+
+static uint64_t bucket_sum(const struct lock_histogram *histogram)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++)
+        sum += histogram->buckets[i];
+    return sum;
+}
+
+void test_lock_profile_uncontended()
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct lock_profile profile;
+    int i;
+
+    lock_profile_init(&profile, "uncontended");
+    for (i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL_INT(0, lock_profile_mutex_lock(&profile, &mutex));
+        TEST_ASSERT_EQUAL_INT(0, lock_profile_mutex_unlock(&profile, &mutex));
+    }
+    TEST_ASSERT_EQUAL_UINT64(10, profile.acquisitions);
+    TEST_ASSERT_EQUAL_UINT64(0, profile.contended);
+    TEST_ASSERT_EQUAL_UINT64(10, profile.wait.count);
+    TEST_ASSERT_EQUAL_UINT64(10, profile.hold.count);
+    TEST_ASSERT_EQUAL_UINT64(10, bucket_sum(&profile.wait));
+    TEST_ASSERT_EQUAL_UINT64(10, bucket_sum(&profile.hold));
+    TEST_ASSERT_LESS_THAN_UINT64_MESSAGE(1000000, profile.wait.max_ns,
+                                         "An uncontended lock should not wait");
+}
+
+/**
+* Hold the mutex for 200 ms while CONTENDERS threads ask for it, then let one more thread
+* take it uncontended and hold it for 50 ms. Every contender waits about 200 ms and holds
+* for no time at all.
+*/
+void test_lock_profile_contention_pattern()
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t threads[CONTENDERS + 1];
+    struct lock_profile profile;
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *out;
+    int i;
+
+    lock_profile_init(&profile, "pattern");
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < CONTENDERS; i++)
+        TEST_ASSERT_TRUE(start_thread_obtaining_mutex(&threads[i], &mutex, 0, 0));
+    usleep(200000);
+    pthread_mutex_unlock(&mutex);
+    for (i = 0; i < CONTENDERS; i++)
+        TEST_ASSERT_TRUE(join_thread_obtaining_mutex(threads[i], &profile));
+
+    TEST_ASSERT_TRUE(start_thread_obtaining_mutex(&threads[CONTENDERS], &mutex, 0, 50));
+    TEST_ASSERT_TRUE(join_thread_obtaining_mutex(threads[CONTENDERS], &profile));
+
+    TEST_ASSERT_EQUAL_UINT64(CONTENDERS + 1, profile.acquisitions);
+    TEST_ASSERT_EQUAL_UINT64(CONTENDERS, profile.contended);
+    TEST_ASSERT_EQUAL_UINT64(CONTENDERS + 1, profile.wait.count);
+    TEST_ASSERT_EQUAL_UINT64(CONTENDERS + 1, bucket_sum(&profile.wait));
+    TEST_ASSERT_EQUAL_UINT64(CONTENDERS + 1, profile.hold.count);
+    TEST_ASSERT_EQUAL_UINT64(CONTENDERS + 1, bucket_sum(&profile.hold));
+
+    // The contenders' waits of about 200 ms all land in the 134 to 268 ms bucket
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(CONTENDERS, profile.wait.buckets[bucket_of_ms(200)],
+                                     "Contended waits should be about 200 ms");
+    TEST_ASSERT_LESS_OR_EQUAL_UINT64(268435455, profile.wait.max_ns);
+    // The last thread holds for 50 ms, in the 34 to 67 ms bucket
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(1, profile.hold.buckets[bucket_of_ms(50)],
+                                     "One hold should be about 50 ms");
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT64(50000000, profile.hold.max_ns);
+
+    // Three of four waits were long, so the median is bounded by the 200 ms bucket
+    TEST_ASSERT_EQUAL_UINT64(profile.wait.max_ns, lock_histogram_percentile(&profile.wait, 50));
+    TEST_ASSERT_LESS_THAN_UINT64(1000000, lock_histogram_percentile(&profile.wait, 25));
+
+    out = open_memstream(&report, &report_len);
+    TEST_ASSERT_NOT_NULL(out);
+    lock_profile_report(&profile, out);
+    fclose(out);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(report, "pattern: 4 acquisitions, 3 contended (75.0%)"),
+                                 report);
+    free(report);
+}
+
+void test_lock_profile_merge_and_percentile()
+{
+    struct lock_profile a, b;
+
+    lock_profile_init(&a, "a");
+    lock_profile_init(&b, "b");
+    a.acquisitions = 4;
+    a.contended = 1;
+    a.wait.count = 4;
+    a.wait.buckets[0] = 1;      // 0 ns
+    a.wait.buckets[3] = 3;      // 4 to 7 ns
+    a.wait.max_ns = 7;
+    b.acquisitions = 4;
+    b.contended = 3;
+    b.wait.count = 4;
+    b.wait.buckets[10] = 4;     // 512 to 1023 ns
+    b.wait.max_ns = 900;
+
+    lock_profile_merge(&a, &b);
+    TEST_ASSERT_EQUAL_UINT64(8, a.acquisitions);
+    TEST_ASSERT_EQUAL_UINT64(4, a.contended);
+    TEST_ASSERT_EQUAL_UINT64(8, a.wait.count);
+    TEST_ASSERT_EQUAL_UINT64(900, a.wait.max_ns);
+    TEST_ASSERT_EQUAL_UINT64(4, a.wait.buckets[10]);
+
+    // Ranks 1, 2 to 4 and 5 to 8 fall in buckets 0, 3 and 10
+    TEST_ASSERT_EQUAL_UINT64(0, lock_histogram_percentile(&a.wait, 10));
+    TEST_ASSERT_EQUAL_UINT64(7, lock_histogram_percentile(&a.wait, 50));
+    // Bucket 10 reaches 1023 ns, but nothing longer than 900 ns was seen
+    TEST_ASSERT_EQUAL_UINT64(900, lock_histogram_percentile(&a.wait, 51));
+    TEST_ASSERT_EQUAL_UINT64(900, lock_histogram_percentile(&a.wait, 100));
+    TEST_ASSERT_EQUAL_UINT64(0, lock_histogram_percentile(&a.hold, 50));
+}
@@ -0,0 +1,168 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../examples/threading/threading.h"
+
+// How late a task may fire or take its mutex on a loaded machine
+#define SCHEDULER_SLACK_MS 50
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct held_interval {
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+static int compare_intervals(const void *a, const void *b)
+{
+    const struct held_interval *x = a, *y = b;
+
+    return x->start_ns < y->start_ns ? -1 : x->start_ns > y->start_ns;
+}
+
+/**
+* Start @param count tasks on @param mutex, task i due after delays[i] ms and holding for
+* @param hold_ms, then join them and check no two held the mutex at the same time.
+* Each held interval is measured inside the real critical section, after locking and
+* before unlocking, so intervals from correctly excluded tasks can never overlap.
+*/
+static void check_mutual_exclusion(struct lock_scheduler *sched, pthread_mutex_t *mutex,
+                                   const int *delays, size_t count, int hold_ms)
+{
+    struct lock_task **tasks = calloc(count, sizeof(*tasks));
+    struct held_interval *held = calloc(count, sizeof(*held));
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL(tasks);
+    TEST_ASSERT_NOT_NULL(held);
+    for (i = 0; i < count; i++)
+        TEST_ASSERT_TRUE(start_task_obtaining_mutex(sched, &tasks[i], mutex, delays[i], hold_ms));
+    for (i = 0; i < count; i++) {
+        struct thread_data *data = join_task_obtaining_mutex(sched, tasks[i]);
+
+        TEST_ASSERT_TRUE(data->thread_complete_success);
+        TEST_ASSERT_EQUAL_UINT64(1, data->profile.acquisitions);
+        held[i].start_ns = data->profile.locked_at_ns;
+        held[i].end_ns = data->profile.locked_at_ns + data->profile.hold.total_ns;
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64_MESSAGE(hold_ms * 1000000ull, data->profile.hold.total_ns,
+                                                    "A task released its mutex early");
+        free(data);
+    }
+
+    qsort(held, count, sizeof(*held), compare_intervals);
+    for (i = 1; i < count; i++)
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64_MESSAGE(held[i - 1].end_ns, held[i].start_ns,
+                                                    "Two tasks held the mutex at once");
+    free(held);
+    free(tasks);
+}
+
+void test_lock_scheduler_delays_across_wheel_levels()
+{
+    // Level 0 holds timers due within 64 ms, level 1 within 4096 ms, level 2 beyond
+    static const int delays[] = { 0, 1, 10, 63, 64, 100, 1000, 4095, 4200 };
+    const size_t count = sizeof(delays) / sizeof(delays[0]);
+    pthread_mutex_t mutexes[sizeof(delays) / sizeof(delays[0])];
+    struct lock_task *tasks[sizeof(delays) / sizeof(delays[0])];
+    uint64_t started_ns[sizeof(delays) / sizeof(delays[0])];
+    struct lock_scheduler *sched;
+    size_t i;
+
+    sched = lock_scheduler_create(2);
+    TEST_ASSERT_NOT_NULL(sched);
+    // Separate mutexes, so each task fires exactly when it is due
+    for (i = 0; i < count; i++) {
+        pthread_mutex_init(&mutexes[i], NULL);
+        started_ns[i] = now_ns();
+        TEST_ASSERT_TRUE(start_task_obtaining_mutex(sched, &tasks[i], &mutexes[i], delays[i], 0));
+    }
+    for (i = 0; i < count; i++) {
+        struct thread_data *data = join_task_obtaining_mutex(sched, tasks[i]);
+        uint64_t fired_ns = data->profile.locked_at_ns - started_ns[i];
+
+        TEST_ASSERT_TRUE(data->thread_complete_success);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64_MESSAGE(delays[i] * 1000000ull, fired_ns,
+                                                    "A task fired before its delay");
+        TEST_ASSERT_LESS_THAN_UINT64_MESSAGE((delays[i] + SCHEDULER_SLACK_MS) * 1000000ull,
+                                             fired_ns, "A task fired long after its delay");
+        free(data);
+        pthread_mutex_destroy(&mutexes[i]);
+    }
+    lock_scheduler_destroy(sched);
+}
+
+void test_lock_scheduler_mutual_exclusion()
+{
+    int delays[40];
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct lock_scheduler *sched;
+    size_t i;
+
+    // Many tasks due close together, spread over more workers than can hold the mutex
+    for (i = 0; i < sizeof(delays) / sizeof(delays[0]); i++)
+        delays[i] = i % 5;
+    sched = lock_scheduler_create(4);
+    TEST_ASSERT_NOT_NULL(sched);
+    check_mutual_exclusion(sched, &mutex, delays, sizeof(delays) / sizeof(delays[0]), 2);
+    lock_scheduler_destroy(sched);
+}
+
+void test_lock_scheduler_recursive_mutex()
+{
+    static const int delays[] = { 0, 0, 1, 1 };
+    pthread_mutexattr_t attr;
+    pthread_mutex_t mutex;
+    struct lock_scheduler *sched;
+
+    // A single worker could lock a recursive mutex again for every task
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    sched = lock_scheduler_create(1);
+    TEST_ASSERT_NOT_NULL(sched);
+    check_mutual_exclusion(sched, &mutex, delays, sizeof(delays) / sizeof(delays[0]), 20);
+    lock_scheduler_destroy(sched);
+    pthread_mutex_destroy(&mutex);
+}
+
+void test_lock_scheduler_fifo_handoff()
+{
+    static const int delays[] = { 0, 10, 20, 30 };
+    const size_t count = sizeof(delays) / sizeof(delays[0]);
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct lock_task *tasks[sizeof(delays) / sizeof(delays[0])];
+    uint64_t released_ns = 0;
+    struct lock_scheduler *sched;
+    size_t i;
+
+    // Each task is due while the previous one still holds the mutex for 100 ms
+    sched = lock_scheduler_create(2);
+    TEST_ASSERT_NOT_NULL(sched);
+    for (i = 0; i < count; i++)
+        TEST_ASSERT_TRUE(start_task_obtaining_mutex(sched, &tasks[i], &mutex, delays[i], 100));
+    for (i = 0; i < count; i++) {
+        struct thread_data *data = join_task_obtaining_mutex(sched, tasks[i]);
+
+        TEST_ASSERT_TRUE(data->thread_complete_success);
+        TEST_ASSERT_EQUAL_UINT64(i > 0 ? 1 : 0, data->profile.contended);
+        if (i > 0) {
+            // Taken in the order they became due, as soon as the previous task let go
+            TEST_ASSERT_GREATER_OR_EQUAL_UINT64(released_ns, data->profile.locked_at_ns);
+            TEST_ASSERT_LESS_THAN_UINT64_MESSAGE(released_ns + SCHEDULER_SLACK_MS * 1000000ull,
+                                                 data->profile.locked_at_ns,
+                                                 "The mutex was not handed to the next task");
+        }
+        released_ns = data->profile.locked_at_ns + data->profile.hold.total_ns;
+        free(data);
+    }
+    lock_scheduler_destroy(sched);
+}